@@ -35,9 +35,28 @@ struct AttributeInfo
         return 0;
     }
 
+    // mat3 and mat4 attributes span one attribute location per column.
+    // A count of 4 is always a vec4, mat2 attributes aren't supported.
+    GLint locationCount()
+    {
+        switch(count)
+        {
+        case 9:  return 3;
+        case 16: return 4;
+        }
+        assert(count >= 1 && count <= 4);
+        return 1;
+    }
+
+    GLint componentsPerLocation()
+    {
+        return count / locationCount();
+    }
+
     std::string name;
     Type type;
     GLint count;
+    GLuint divisor; // 0 for per-vertex attributes, N to advance once every N instances.
 
 };
 
@@ -10,6 +10,13 @@
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl3.h"
 
+#include "GLState.h"
+#include "IndexBuffer.h"
+#include "PerView.h"
+#include "RenderStats.h"
+#include "Texture.h"
+#include "VertexArrayCache.h"
+
 struct BaseApp
 {
     int displayWidth, displayHeight;
@@ -20,11 +27,41 @@ struct BaseApp
     SDL_GLContext context = NULL;
     GLuint defaultVAO = 0;
 
+    // On-demand rendering: frames are only drawn after input, while the user
+    // reports an animation, or when requested. Otherwise step() sleeps in
+    // SDL_WaitEventTimeout. Unfocused windows are capped to a low frame rate
+    // and minimized windows are not drawn at all.
+    static const int RedrawFramesAfterInput = 4; // ImGui and GPU query results need a few frames to settle
+    static const int IdleWaitMs = 250;
+    static const int MinimizedWaitMs = 500;
+    static const Uint32 UnfocusedFrameMs = 100;
+
+    bool onDemand = true;
+    bool isMinimized = false;
+    bool hasFocus = true;
+    int pendingFrames = RedrawFramesAfterInput;
+    Uint32 lastFrameTicks = 0;
+
     virtual bool userInit() = 0;
     virtual void userShutdown() = 0;
     virtual void userRender() = 0;
     virtual void userRenderUI() = 0;
 
+    // Return true while the scene changes on its own, to keep drawing
+    // without input in on-demand mode.
+    virtual bool userIsAnimating()
+    {
+        return false;
+    }
+
+    void requestRedraw(int frames = 1)
+    {
+        if (pendingFrames < frames)
+        {
+            pendingFrames = frames;
+        }
+    }
+
     ~BaseApp()
     {
         if (context)
@@ -135,7 +172,7 @@ struct BaseApp
 #ifndef __EMSCRIPTEN__
         //Default Vertex Array Object
         glGenVertexArrays(1, &defaultVAO);
-        glBindVertexArray(defaultVAO);
+        GLState::current().bindVertexArray(defaultVAO);
 #endif
 
         //Use Vsync to avoid unwanted screen tearing.
@@ -166,18 +203,78 @@ struct BaseApp
         return 0;
     }
 
+    void processEvent(const SDL_Event &e)
+    {
+        // User requests quit
+        if (e.type == SDL_QUIT) {
+            isRunning = false;
+        }
+
+        if (e.type == SDL_WINDOWEVENT) {
+            switch (e.window.event) {
+            case SDL_WINDOWEVENT_MINIMIZED:
+            case SDL_WINDOWEVENT_HIDDEN:
+                isMinimized = true;
+                break;
+            case SDL_WINDOWEVENT_RESTORED:
+            case SDL_WINDOWEVENT_MAXIMIZED:
+            case SDL_WINDOWEVENT_SHOWN:
+                isMinimized = false;
+                break;
+            case SDL_WINDOWEVENT_FOCUS_GAINED:
+                hasFocus = true;
+                break;
+            case SDL_WINDOWEVENT_FOCUS_LOST:
+                hasFocus = false;
+                break;
+            }
+        }
+
+        ImGui_ImplSDL2_ProcessEvent(&e);
+        requestRedraw(RedrawFramesAfterInput);
+    }
+
     void step()
     {
+        bool animating = !onDemand || userIsAnimating();
+
         SDL_Event e;
-        while (SDL_PollEvent(&e) != 0) {
-            // User requests quit
-            if (e.type == SDL_QUIT) {
-                isRunning = false;
+#ifndef __EMSCRIPTEN__
+        // Sleep until something happens. The browser drives the loop under
+        // Emscripten, the frame is simply skipped there.
+        if (isMinimized) {
+            if (SDL_WaitEventTimeout(&e, MinimizedWaitMs)) {
+                processEvent(e);
             }
+        } else if (!animating && pendingFrames == 0) {
+            if (SDL_WaitEventTimeout(&e, IdleWaitMs)) {
+                processEvent(e);
+            }
+        }
+#endif
+        while (SDL_PollEvent(&e) != 0) {
+            processEvent(e);
+        }
 
-            ImGui_ImplSDL2_ProcessEvent(&e);
+        if (isMinimized || (!animating && pendingFrames == 0)) {
+            return;
         }
 
+#ifndef __EMSCRIPTEN__
+        if (!hasFocus) {
+            Uint32 elapsed = SDL_GetTicks() - lastFrameTicks;
+            if (elapsed < UnfocusedFrameMs) {
+                SDL_Delay(UnfocusedFrameMs - elapsed);
+            }
+        }
+#endif
+        lastFrameTicks = SDL_GetTicks();
+        if (pendingFrames > 0) {
+            pendingFrames--;
+        }
+
+        RenderStats::frame().reset();
+
         SDL_GL_GetDrawableSize(window, &displayWidth, &displayHeight);
         glViewport(0, 0, displayWidth, displayHeight);
         glClearColor(clearColor.r, clearColor.g, clearColor.b, clearColor.a);
@@ -191,6 +288,10 @@ struct BaseApp
         userRenderUI();
         ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 
+        // ImGui changes the GL state behind our back. It restores most of
+        // it, but don't rely on that.
+        GLState::current().invalidate();
+
         SDL_GL_SwapWindow(window);
     }
 
@@ -200,7 +301,12 @@ struct BaseApp
         // User Shutdown
         userShutdown();
 
-        glBindVertexArray(0);
+        IndexBuffer::releaseShared();
+        VertexArrayCache::shared().clear();
+        PerViewBuffer::shared().release();
+        Texture::releasePlaceholder();
+
+        GLState::current().bindVertexArray(0);
         glDeleteVertexArrays(1, &defaultVAO);
         defaultVAO = 0;
 
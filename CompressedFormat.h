@@ -0,0 +1,415 @@
+#ifndef COMPRESSEDFORMAT_H
+#define COMPRESSEDFORMAT_H
+
+#include <cstdint>
+#include <cstring>
+
+#include <glad/glad.h>
+#include <SDL2/SDL.h>
+
+// S3TC is an extension on every API, our glad build has no extensions
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+
+// Block compressed texture formats we can load from KTX files, with their
+// availability in the current context and, when we have one, a CPU decoder
+// to RGBA8 used when the context can't sample the format.
+//
+// All formats use 4x4 blocks. detect() must run on the GL thread before
+// supported() is called from any thread.
+struct CompressedFormat
+{
+    typedef void (*DecodeBlock)(const uint8_t *block, uint8_t rgba[4 * 4 * 4]);
+
+    const char *name;
+    GLenum glFormat;
+    uint32_t vkFormat;  // KTX2 identifies formats with VkFormat
+    int blockBytes;
+    DecodeBlock decodeBlock;
+    bool available;
+
+    // Most to least preferred, smaller and higher quality first
+    static CompressedFormat *formats(int &count)
+    {
+        static CompressedFormat table[] = {
+            { "ASTC 4x4",   GL_COMPRESSED_RGBA_ASTC_4x4,       157, 16, NULL,                false },
+            { "BC7",        GL_COMPRESSED_RGBA_BPTC_UNORM,     145, 16, NULL,                false },
+            { "BC3",        GL_COMPRESSED_RGBA_S3TC_DXT5_EXT,  137, 16, decodeBC3,           false },
+            { "BC1",        GL_COMPRESSED_RGB_S3TC_DXT1_EXT,   131,  8, decodeBC1,           false },
+            { "BC1 RGBA",   GL_COMPRESSED_RGBA_S3TC_DXT1_EXT,  133,  8, decodeBC1Alpha,      false },
+            { "ETC2 RGBA",  GL_COMPRESSED_RGBA8_ETC2_EAC,      151, 16, decodeETC2EAC,       false },
+            { "ETC2 RGB",   GL_COMPRESSED_RGB8_ETC2,           147,  8, decodeETC2,          false },
+        };
+        count = (int)(sizeof(table) / sizeof(table[0]));
+        return table;
+    }
+
+    static CompressedFormat *findGL(GLenum glFormat)
+    {
+        int count = 0;
+        CompressedFormat *table = formats(count);
+        for(int i = 0; i < count; ++i)
+        {
+            if (table[i].glFormat == glFormat)
+            {
+                return &table[i];
+            }
+        }
+        return NULL;
+    }
+
+    static CompressedFormat *findVk(uint32_t vkFormat)
+    {
+        int count = 0;
+        CompressedFormat *table = formats(count);
+        for(int i = 0; i < count; ++i)
+        {
+            if (table[i].vkFormat == vkFormat)
+            {
+                return &table[i];
+            }
+        }
+        return NULL;
+    }
+
+    // 0 when not in the preference list
+    static int preference(const CompressedFormat *format)
+    {
+        int count = 0;
+        CompressedFormat *table = formats(count);
+        return format ? count - (int)(format - table) : 0;
+    }
+
+    // Desktop GL exposes ETC2 from 4.3, but drivers without hardware support
+    // decompress it at upload, so BCn formats rank above it. Mesa's
+    // software drivers support S3TC, BPTC and ETC2.
+    static void detect(bool forceFallback = false)
+    {
+        bool s3tc = SDL_GL_ExtensionSupported("GL_EXT_texture_compression_s3tc") ||
+                    SDL_GL_ExtensionSupported("GL_WEBGL_compressed_texture_s3tc");
+        bool bptc = GLAD_GL_VERSION_4_2 ||
+                    SDL_GL_ExtensionSupported("GL_ARB_texture_compression_bptc") ||
+                    SDL_GL_ExtensionSupported("GL_EXT_texture_compression_bptc");
+        bool etc2 = GLAD_GL_ES_VERSION_3_0 || GLAD_GL_VERSION_4_3 ||
+                    SDL_GL_ExtensionSupported("GL_ARB_ES3_compatibility");
+        bool astc = SDL_GL_ExtensionSupported("GL_KHR_texture_compression_astc_ldr");
+        bool upload = glCompressedTexImage2D != NULL && !forceFallback;
+
+        int count = 0;
+        CompressedFormat *table = formats(count);
+        for(int i = 0; i < count; ++i)
+        {
+            switch(table[i].glFormat)
+            {
+                case GL_COMPRESSED_RGBA_ASTC_4x4:      table[i].available = upload && astc; break;
+                case GL_COMPRESSED_RGBA_BPTC_UNORM:    table[i].available = upload && bptc; break;
+                case GL_COMPRESSED_RGBA8_ETC2_EAC:
+                case GL_COMPRESSED_RGB8_ETC2:          table[i].available = upload && etc2; break;
+                default:                               table[i].available = upload && s3tc; break;
+            }
+        }
+    }
+
+    static size_t levelByteCount(int blockBytes, int width, int height)
+    {
+        return (size_t)((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+    }
+
+    // Decodes a whole level to tightly packed RGBA8, rgba holds width * height * 4 bytes.
+    void decode(const uint8_t *blocks, int width, int height, uint8_t *rgba) const
+    {
+        uint8_t texels[4 * 4 * 4];
+        for(int by = 0; by < height; by += 4)
+        {
+            for(int bx = 0; bx < width; bx += 4)
+            {
+                decodeBlock(blocks, texels);
+                blocks += blockBytes;
+
+                for(int y = 0; y < 4 && by + y < height; ++y)
+                {
+                    int columns = width - bx < 4 ? width - bx : 4;
+                    memcpy(rgba + ((size_t)(by + y) * width + bx) * 4, texels + y * 16, columns * 4);
+                }
+            }
+        }
+    }
+
+    static uint8_t clamp255(int value)
+    {
+        return (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+    }
+
+    // BC1 color block: two RGB565 endpoints and 2 bits per texel, row major
+    static void decodeBC1Colors(const uint8_t *block, uint8_t rgba[4 * 4 * 4], bool fourColors, bool punchThrough)
+    {
+        int c0 = block[0] | block[1] << 8;
+        int c1 = block[2] | block[3] << 8;
+
+        int colors[4][4];
+        for(int e = 0; e < 2; ++e)
+        {
+            int c = e ? c1 : c0;
+            int r = (c >> 11) & 31, g = (c >> 5) & 63, b = c & 31;
+            colors[e][0] = r << 3 | r >> 2;
+            colors[e][1] = g << 2 | g >> 4;
+            colors[e][2] = b << 3 | b >> 2;
+            colors[e][3] = 255;
+        }
+        for(int ch = 0; ch < 4; ++ch)
+        {
+            if (fourColors || c0 > c1)
+            {
+                colors[2][ch] = (2 * colors[0][ch] + colors[1][ch]) / 3;
+                colors[3][ch] = (colors[0][ch] + 2 * colors[1][ch]) / 3;
+            }
+            else
+            {
+                colors[2][ch] = (colors[0][ch] + colors[1][ch]) / 2;
+                colors[3][ch] = ch == 3 && !punchThrough ? 255 : 0;
+            }
+        }
+
+        uint32_t indices = block[4] | block[5] << 8 | block[6] << 16 | (uint32_t)block[7] << 24;
+        for(int i = 0; i < 16; ++i)
+        {
+            const int *color = colors[(indices >> (2 * i)) & 3];
+            for(int ch = 0; ch < 4; ++ch)
+            {
+                rgba[i * 4 + ch] = (uint8_t)color[ch];
+            }
+        }
+    }
+
+    static void decodeBC1(const uint8_t *block, uint8_t rgba[4 * 4 * 4])
+    {
+        decodeBC1Colors(block, rgba, false, false);
+    }
+
+    static void decodeBC1Alpha(const uint8_t *block, uint8_t rgba[4 * 4 * 4])
+    {
+        decodeBC1Colors(block, rgba, false, true);
+    }
+
+    // BC3: BC4 style alpha block followed by a four color BC1 block
+    static void decodeBC3(const uint8_t *block, uint8_t rgba[4 * 4 * 4])
+    {
+        decodeBC1Colors(block + 8, rgba, true, false);
+
+        int alphas[8];
+        alphas[0] = block[0];
+        alphas[1] = block[1];
+        if (alphas[0] > alphas[1])
+        {
+            for(int i = 1; i < 7; ++i)
+            {
+                alphas[i + 1] = ((7 - i) * alphas[0] + i * alphas[1]) / 7;
+            }
+        }
+        else
+        {
+            for(int i = 1; i < 5; ++i)
+            {
+                alphas[i + 1] = ((5 - i) * alphas[0] + i * alphas[1]) / 5;
+            }
+            alphas[6] = 0;
+            alphas[7] = 255;
+        }
+
+        uint64_t indices = 0;
+        for(int b = 0; b < 6; ++b)
+        {
+            indices |= (uint64_t)block[2 + b] << (8 * b);
+        }
+        for(int i = 0; i < 16; ++i)
+        {
+            rgba[i * 4 + 3] = (uint8_t)alphas[(indices >> (3 * i)) & 7];
+        }
+    }
+
+    // ETC2 RGB: big endian 64 bit block, with ETC1's individual and
+    // differential modes plus T, H and planar modes encoded as overflowing
+    // differential colors. Texel indices are column major.
+    static void decodeETC2(const uint8_t *block, uint8_t rgba[4 * 4 * 4])
+    {
+        static const int modifiers[8][4] = {
+            {  2,   8,  -2,   -8 }, {  5,  17,  -5,  -17 }, {  9,  29,  -9,  -29 }, { 13,  42, -13,  -42 },
+            { 18,  60, -18,  -60 }, { 24,  80, -24,  -80 }, { 33, 106, -33, -106 }, { 47, 183, -47, -183 },
+        };
+        static const int distances[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+        uint32_t high = (uint32_t)block[0] << 24 | block[1] << 16 | block[2] << 8 | block[3];
+        uint32_t low = (uint32_t)block[4] << 24 | block[5] << 16 | block[6] << 8 | block[7];
+
+        int r1 = 0, g1 = 0, b1 = 0, r2 = 0, g2 = 0, b2 = 0;
+        if (high & 2)
+        {
+            int r = high >> 27, g = (high >> 19) & 31, b = (high >> 11) & 31;
+            int dr = ((int)(high >> 24) & 7) ^ 4, dg = ((int)(high >> 16) & 7) ^ 4, db = ((int)(high >> 8) & 7) ^ 4;
+            dr -= 4; dg -= 4; db -= 4;
+
+            if (r + dr < 0 || r + dr > 31)
+            {
+                // T mode: the second color and its two shifted copies, plus the first
+                int paint[4][3];
+                setColor4(paint[0], (high >> 25 & 0xC) | (high >> 24 & 3), high >> 20 & 15, high >> 16 & 15);
+                setColor4(paint[2], high >> 12 & 15, high >> 8 & 15, high >> 4 & 15);
+                int d = distances[(high >> 1 & 6) | (high & 1)];
+                for(int ch = 0; ch < 3; ++ch)
+                {
+                    paint[1][ch] = clamp255(paint[2][ch] + d);
+                    paint[3][ch] = clamp255(paint[2][ch] - d);
+                }
+                writePaint(paint, low, rgba);
+                return;
+            }
+
+            if (g + dg < 0 || g + dg > 31)
+            {
+                // H mode: two colors, each shifted both ways
+                int c1r = high >> 27 & 15, c1g = (high >> 23 & 14) | (high >> 20 & 1), c1b = (high >> 16 & 8) | (high >> 15 & 7);
+                int c2r = high >> 11 & 15, c2g = high >> 7 & 15, c2b = high >> 3 & 15;
+                int order = (c1r << 8 | c1g << 4 | c1b) >= (c2r << 8 | c2g << 4 | c2b) ? 1 : 0;
+                int d = distances[(high & 4) | (high << 1 & 2) | order];
+
+                int base[2][3];
+                setColor4(base[0], c1r, c1g, c1b);
+                setColor4(base[1], c2r, c2g, c2b);
+                int paint[4][3];
+                for(int ch = 0; ch < 3; ++ch)
+                {
+                    paint[0][ch] = clamp255(base[0][ch] + d);
+                    paint[1][ch] = clamp255(base[0][ch] - d);
+                    paint[2][ch] = clamp255(base[1][ch] + d);
+                    paint[3][ch] = clamp255(base[1][ch] - d);
+                }
+                writePaint(paint, low, rgba);
+                return;
+            }
+
+            if (b + db < 0 || b + db > 31)
+            {
+                // Planar mode: a gradient through three RGB676 colors
+                int o[3], h[3], v[3];
+                o[0] = extend(high >> 25 & 63, 6);
+                o[1] = extend((high >> 18 & 64) | (high >> 17 & 63), 7);
+                o[2] = extend((high >> 11 & 32) | (high >> 8 & 24) | (high >> 7 & 7), 6);
+                h[0] = extend((high >> 1 & 62) | (high & 1), 6);
+                h[1] = extend(low >> 25, 7);
+                h[2] = extend(low >> 19 & 63, 6);
+                v[0] = extend(low >> 13 & 63, 6);
+                v[1] = extend(low >> 6 & 127, 7);
+                v[2] = extend(low & 63, 6);
+
+                for(int x = 0; x < 4; ++x)
+                {
+                    for(int y = 0; y < 4; ++y)
+                    {
+                        uint8_t *texel = rgba + (y * 4 + x) * 4;
+                        for(int ch = 0; ch < 3; ++ch)
+                        {
+                            texel[ch] = clamp255((x * (h[ch] - o[ch]) + y * (v[ch] - o[ch]) + 4 * o[ch] + 2) >> 2);
+                        }
+                        texel[3] = 255;
+                    }
+                }
+                return;
+            }
+
+            // Differential mode: RGB555 plus a RGB333 signed delta
+            r1 = r << 3 | r >> 2; g1 = g << 3 | g >> 2; b1 = b << 3 | b >> 2;
+            r += dr; g += dg; b += db;
+            r2 = r << 3 | r >> 2; g2 = g << 3 | g >> 2; b2 = b << 3 | b >> 2;
+        }
+        else
+        {
+            // Individual mode: two RGB444 colors
+            r1 = (high >> 28) * 17; r2 = (high >> 24 & 15) * 17;
+            g1 = (high >> 20 & 15) * 17; g2 = (high >> 16 & 15) * 17;
+            b1 = (high >> 12 & 15) * 17; b2 = (high >> 8 & 15) * 17;
+        }
+
+        const int *table1 = modifiers[high >> 5 & 7];
+        const int *table2 = modifiers[high >> 2 & 7];
+        bool flip = (high & 1) != 0;
+        for(int x = 0; x < 4; ++x)
+        {
+            for(int y = 0; y < 4; ++y)
+            {
+                int i = x * 4 + y;
+                int index = (low >> (15 + i) & 2) | (low >> i & 1);
+                bool second = flip ? y >= 2 : x >= 2;
+                int modifier = (second ? table2 : table1)[index];
+
+                uint8_t *texel = rgba + (y * 4 + x) * 4;
+                texel[0] = clamp255((second ? r2 : r1) + modifier);
+                texel[1] = clamp255((second ? g2 : g1) + modifier);
+                texel[2] = clamp255((second ? b2 : b1) + modifier);
+                texel[3] = 255;
+            }
+        }
+    }
+
+    // ETC2 RGBA: EAC alpha block followed by an ETC2 RGB block
+    static void decodeETC2EAC(const uint8_t *block, uint8_t rgba[4 * 4 * 4])
+    {
+        static const int modifiers[16][8] = {
+            { -3, -6, -9, -15, 2, 5, 8, 14 }, { -3, -7, -10, -13, 2, 6, 9, 12 },
+            { -2, -5, -8, -13, 1, 4, 7, 12 }, { -2, -4, -6, -13, 1, 3, 5, 12 },
+            { -3, -6, -8, -12, 2, 5, 7, 11 }, { -3, -7, -9, -11, 2, 6, 8, 10 },
+            { -4, -7, -8, -11, 3, 6, 7, 10 }, { -3, -5, -8, -11, 2, 4, 7, 10 },
+            { -2, -6, -8, -10, 1, 5, 7, 9 },  { -2, -5, -8, -10, 1, 4, 7, 9 },
+            { -2, -4, -8, -10, 1, 3, 7, 9 },  { -2, -5, -7, -10, 1, 4, 6, 9 },
+            { -3, -4, -7, -10, 2, 3, 6, 9 },  { -1, -2, -3, -10, 0, 1, 2, 9 },
+            { -4, -6, -8, -9, 3, 5, 7, 8 },   { -3, -5, -7, -9, 2, 4, 6, 8 },
+        };
+
+        decodeETC2(block + 8, rgba);
+
+        int base = block[0];
+        int multiplier = block[1] >> 4;
+        const int *table = modifiers[block[1] & 15];
+        uint64_t indices = 0;
+        for(int b = 2; b < 8; ++b)
+        {
+            indices = indices << 8 | block[b];
+        }
+        for(int i = 0; i < 16; ++i)
+        {
+            int x = i / 4, y = i % 4;
+            int index = (int)(indices >> (45 - 3 * i)) & 7;
+            rgba[(y * 4 + x) * 4 + 3] = clamp255(base + table[index] * multiplier);
+        }
+    }
+
+    static int extend(int value, int bits)
+    {
+        return value << (8 - bits) | value >> (2 * bits - 8);
+    }
+
+    static void setColor4(int color[3], int r, int g, int b)
+    {
+        color[0] = r * 17;
+        color[1] = g * 17;
+        color[2] = b * 17;
+    }
+
+    static void writePaint(const int paint[4][3], uint32_t low, uint8_t rgba[4 * 4 * 4])
+    {
+        for(int i = 0; i < 16; ++i)
+        {
+            int x = i / 4, y = i % 4;
+            const int *color = paint[(low >> (15 + i) & 2) | (low >> i & 1)];
+            uint8_t *texel = rgba + (y * 4 + x) * 4;
+            texel[0] = (uint8_t)color[0];
+            texel[1] = (uint8_t)color[1];
+            texel[2] = (uint8_t)color[2];
+            texel[3] = 255;
+        }
+    }
+};
+
+#endif // COMPRESSEDFORMAT_H
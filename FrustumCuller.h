@@ -0,0 +1,329 @@
+#ifndef FRUSTUMCULLER_H
+#define FRUSTUMCULLER_H
+
+#include <cmath>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifndef __EMSCRIPTEN__
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FRUSTUMCULLER_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// AVX is enabled per function, the rest of the program keeps its baseline ISA.
+#if defined(FRUSTUMCULLER_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define FRUSTUMCULLER_AVX 1
+#include <immintrin.h>
+#include <SDL2/SDL_cpuinfo.h>
+#endif
+
+// Tests world space bounding boxes against the frustum of a projection
+// matrix. Boxes are kept as structure of arrays (centers and half extents)
+// so they can be tested 8 (AVX) or 4 (SSE2) at a time, and large sets are
+// split across worker threads. The workers are started by the first cull
+// large enough to need them and then sleep between frames, so a cull only
+// pays for waking them.
+//
+// The far plane is ignored: Front to Back mode flattens z, so nothing is
+// clipped by it.
+struct FrustumCuller
+{
+    static const size_t PlaneCount = 5;
+    static const size_t MinBoxesPerThread = 16384;
+
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+    std::vector<unsigned char> visible;
+    glm::vec4 planes[PlaneCount];
+
+#ifndef __EMSCRIPTEN__
+    // Current job, guarded by jobMutex. Worker t culls chunk t.
+    std::mutex jobMutex;
+    std::condition_variable jobStarted;
+    std::condition_variable jobFinished;
+    std::vector<std::thread> workers;
+    std::vector<size_t> visibleCounts;
+    unsigned int generation = 0;
+    size_t jobChunk = 0;
+    size_t jobThreads = 0;
+    size_t pendingWorkers = 0;
+    bool stopping = false;
+
+    ~FrustumCuller()
+    {
+        {
+            std::lock_guard<std::mutex> lock(jobMutex);
+            stopping = true;
+        }
+        jobStarted.notify_all();
+
+        for(size_t t = 0; t < workers.size(); ++t)
+        {
+            workers[t].join();
+        }
+    }
+#endif
+
+    size_t size() const
+    {
+        return centerX.size();
+    }
+
+    void resize(size_t count)
+    {
+        centerX.resize(count);
+        centerY.resize(count);
+        centerZ.resize(count);
+        extentX.resize(count);
+        extentY.resize(count);
+        extentZ.resize(count);
+        visible.resize(count);
+    }
+
+    // World space bounds of the box localMin, localMax transformed by model.
+    void setBounds(size_t i, const glm::mat4 &model, const glm::vec3 &localMin, const glm::vec3 &localMax)
+    {
+        glm::vec3 localCenter = (localMin + localMax) * 0.5f;
+        glm::vec3 localExtent = (localMax - localMin) * 0.5f;
+
+        glm::vec4 center = model * glm::vec4(localCenter, 1.0f);
+        centerX[i] = center.x;
+        centerY[i] = center.y;
+        centerZ[i] = center.z;
+
+        // Extent of the transformed box along each world axis
+        extentX[i] = std::fabs(model[0][0]) * localExtent.x + std::fabs(model[1][0]) * localExtent.y + std::fabs(model[2][0]) * localExtent.z;
+        extentY[i] = std::fabs(model[0][1]) * localExtent.x + std::fabs(model[1][1]) * localExtent.y + std::fabs(model[2][1]) * localExtent.z;
+        extentZ[i] = std::fabs(model[0][2]) * localExtent.x + std::fabs(model[1][2]) * localExtent.y + std::fabs(model[2][2]) * localExtent.z;
+    }
+
+    // Extracts the left, right, bottom, top and near planes of a world to clip space matrix.
+    void setFrustum(const glm::mat4 &m)
+    {
+        glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+        glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+        glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+        glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+        planes[0] = row3 + row0;
+        planes[1] = row3 - row0;
+        planes[2] = row3 + row1;
+        planes[3] = row3 - row1;
+        planes[4] = row3 + row2;
+    }
+
+    // Fills visible[] and returns how many boxes are at least partially inside.
+    size_t cull()
+    {
+        size_t count = size();
+
+#ifndef __EMSCRIPTEN__
+        size_t threadCount = std::thread::hardware_concurrency();
+        if (threadCount > count / MinBoxesPerThread)
+        {
+            threadCount = count / MinBoxesPerThread;
+        }
+
+        if (threadCount > 1)
+        {
+            // The calling thread takes chunk 0
+            if (workers.empty())
+            {
+                for(size_t t = 1; t < std::thread::hardware_concurrency(); ++t)
+                {
+                    workers.push_back(std::thread([this, t]() { work(t); }));
+                }
+            }
+            if (threadCount > workers.size() + 1)
+            {
+                threadCount = workers.size() + 1;
+            }
+
+            // Chunks are multiples of 8 boxes so each SIMD lane group stays in one thread
+            size_t chunk = (count / threadCount + 7) & ~(size_t)7;
+            {
+                std::lock_guard<std::mutex> lock(jobMutex);
+                visibleCounts.assign(threadCount, 0);
+                jobChunk = chunk;
+                jobThreads = threadCount;
+                pendingWorkers = threadCount - 1;
+                generation++;
+            }
+            jobStarted.notify_all();
+
+            visibleCounts[0] = cullRange(0, chunk < count ? chunk : count);
+
+            std::unique_lock<std::mutex> lock(jobMutex);
+            jobFinished.wait(lock, [this]() { return pendingWorkers == 0; });
+
+            size_t visibleCount = 0;
+            for(size_t t = 0; t < threadCount; ++t)
+            {
+                visibleCount += visibleCounts[t];
+            }
+            return visibleCount;
+        }
+#endif
+
+        return cullRange(0, count);
+    }
+
+#ifndef __EMSCRIPTEN__
+    void work(size_t index)
+    {
+        unsigned int seen = 0;
+        for(;;)
+        {
+            size_t begin, end;
+            {
+                std::unique_lock<std::mutex> lock(jobMutex);
+                jobStarted.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if (stopping)
+                {
+                    return;
+                }
+
+                // Small jobs leave the last workers out
+                seen = generation;
+                if (index >= jobThreads)
+                {
+                    continue;
+                }
+                size_t count = size();
+                begin = index * jobChunk < count ? index * jobChunk : count;
+                end = begin + jobChunk < count ? begin + jobChunk : count;
+            }
+
+            size_t visibleCount = cullRange(begin, end);
+
+            std::lock_guard<std::mutex> lock(jobMutex);
+            visibleCounts[index] = visibleCount;
+            if (--pendingWorkers == 0)
+            {
+                jobFinished.notify_one();
+            }
+        }
+    }
+#endif
+
+    size_t cullRange(size_t begin, size_t end)
+    {
+#ifdef FRUSTUMCULLER_AVX
+        static const bool hasAVX = SDL_HasAVX() != 0;
+        if (hasAVX)
+        {
+            return cullAVX(begin, end);
+        }
+#endif
+#ifdef FRUSTUMCULLER_SSE2
+        return cullSSE2(begin, end);
+#else
+        return cullScalar(begin, end);
+#endif
+    }
+
+    // A box is outside when it is entirely behind one of the planes:
+    // dot(plane.xyz, center) + plane.w + dot(abs(plane.xyz), extent) < 0
+    size_t cullScalar(size_t begin, size_t end)
+    {
+        size_t visibleCount = 0;
+        for(size_t i = begin; i < end; ++i)
+        {
+            bool inside = true;
+            for(size_t p = 0; p < PlaneCount && inside; ++p)
+            {
+                const glm::vec4 &plane = planes[p];
+                float distance = plane.x * centerX[i] + plane.y * centerY[i] + plane.z * centerZ[i] + plane.w;
+                float radius = std::fabs(plane.x) * extentX[i] + std::fabs(plane.y) * extentY[i] + std::fabs(plane.z) * extentZ[i];
+                inside = distance + radius >= 0.0f;
+            }
+            visible[i] = inside;
+            visibleCount += inside;
+        }
+        return visibleCount;
+    }
+
+#ifdef FRUSTUMCULLER_SSE2
+    size_t cullSSE2(size_t begin, size_t end)
+    {
+        size_t visibleCount = 0;
+        size_t i = begin;
+        for(; i + 4 <= end; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&centerX[i]);
+            __m128 cy = _mm_loadu_ps(&centerY[i]);
+            __m128 cz = _mm_loadu_ps(&centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&extentX[i]);
+            __m128 ey = _mm_loadu_ps(&extentY[i]);
+            __m128 ez = _mm_loadu_ps(&extentZ[i]);
+
+            __m128 outside = _mm_setzero_ps();
+            for(size_t p = 0; p < PlaneCount; ++p)
+            {
+                const glm::vec4 &plane = planes[p];
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), cx), _mm_mul_ps(_mm_set1_ps(plane.y), cy)),
+                                             _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), cz), _mm_set1_ps(plane.w)));
+                __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(std::fabs(plane.x)), ex), _mm_mul_ps(_mm_set1_ps(std::fabs(plane.y)), ey)),
+                                           _mm_mul_ps(_mm_set1_ps(std::fabs(plane.z)), ez));
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            }
+
+            int mask = _mm_movemask_ps(outside);
+            for(int k = 0; k < 4; ++k)
+            {
+                unsigned char inside = !((mask >> k) & 1);
+                visible[i + k] = inside;
+                visibleCount += inside;
+            }
+        }
+        return visibleCount + cullScalar(i, end);
+    }
+#endif
+
+#ifdef FRUSTUMCULLER_AVX
+    __attribute__((target("avx")))
+    size_t cullAVX(size_t begin, size_t end)
+    {
+        size_t visibleCount = 0;
+        size_t i = begin;
+        for(; i + 8 <= end; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&extentZ[i]);
+
+            __m256 outside = _mm256_setzero_ps();
+            for(size_t p = 0; p < PlaneCount; ++p)
+            {
+                const glm::vec4 &plane = planes[p];
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.x), cx), _mm256_mul_ps(_mm256_set1_ps(plane.y), cy)),
+                                                _mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(plane.z), cz), _mm256_set1_ps(plane.w)));
+                __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.x)), ex), _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.y)), ey)),
+                                              _mm256_mul_ps(_mm256_set1_ps(std::fabs(plane.z)), ez));
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+            }
+
+            int mask = _mm256_movemask_ps(outside);
+            for(int k = 0; k < 8; ++k)
+            {
+                unsigned char inside = !((mask >> k) & 1);
+                visible[i + k] = inside;
+                visibleCount += inside;
+            }
+        }
+        return visibleCount + cullSSE2(i, end);
+    }
+#endif
+};
+
+#endif // FRUSTUMCULLER_H
@@ -0,0 +1,188 @@
+#ifndef GLSTATE_H
+#define GLSTATE_H
+
+#include <cassert>
+#include <map>
+
+#include <glad/glad.h>
+
+#include "RenderStats.h"
+
+// Shadows the GL bindings and capabilities we change during a frame so calls
+// that would not change anything never reach the driver.
+//
+// Anything that touches GL behind our back (ImGui's OpenGL3 backend, for one)
+// must be followed by invalidate(), after which the next call of every kind
+// goes through again. Destroyed objects must be forgotten, otherwise a new
+// object recycling the name could be considered already bound.
+struct GLState
+{
+    static const GLuint Unknown = 0xFFFFFFFF;
+    static const GLuint MaxTextureUnits = 16;
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint arrayBuffer;
+    GLuint elementArrayBuffer;
+    GLuint activeTextureUnit;
+    GLuint textures2D[MaxTextureUnits];
+    GLuint textures2DArray[MaxTextureUnits];
+    std::map<GLenum, GLboolean> capabilities;
+
+    GLState()
+    {
+        invalidate();
+    }
+
+    static GLState &current()
+    {
+        static GLState state;
+        return state;
+    }
+
+    void invalidate()
+    {
+        program = Unknown;
+        vertexArray = Unknown;
+        arrayBuffer = Unknown;
+        elementArrayBuffer = Unknown;
+        activeTextureUnit = Unknown;
+        for(GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+        {
+            textures2D[unit] = Unknown;
+            textures2DArray[unit] = Unknown;
+        }
+        capabilities.clear();
+    }
+
+    void useProgram(GLuint handle)
+    {
+        if (changed(program, handle))
+        {
+            glUseProgram(handle);
+        }
+    }
+
+    void bindVertexArray(GLuint handle)
+    {
+        if (changed(vertexArray, handle))
+        {
+            glBindVertexArray(handle);
+
+            // The element array binding is part of the vertex array state
+            elementArrayBuffer = Unknown;
+        }
+    }
+
+    void bindBuffer(GLenum target, GLuint handle)
+    {
+        GLuint *binding = bufferBinding(target);
+        if (!binding || changed(*binding, handle))
+        {
+            glBindBuffer(target, handle);
+        }
+    }
+
+    void activeTexture(GLuint unit)
+    {
+        if (changed(activeTextureUnit, unit))
+        {
+            glActiveTexture(GL_TEXTURE0 + unit);
+        }
+    }
+
+    void bindTexture(GLenum target, GLuint unit, GLuint handle)
+    {
+        assert((target == GL_TEXTURE_2D || target == GL_TEXTURE_2D_ARRAY) && unit < MaxTextureUnits);
+        GLuint &binding = target == GL_TEXTURE_2D ? textures2D[unit] : textures2DArray[unit];
+
+        // Callers follow up with glTex* calls on unit, so it's made active
+        // even when the binding itself is redundant.
+        activeTexture(unit);
+        if (binding == handle)
+        {
+            RenderStats::frame().redundantStateCalls++;
+            return;
+        }
+
+        glBindTexture(target, handle);
+        binding = handle;
+    }
+
+    void setEnabled(GLenum capability, bool enabled)
+    {
+        std::map<GLenum, GLboolean>::iterator it = capabilities.find(capability);
+        if (it != capabilities.end() && it->second == (GLboolean)enabled)
+        {
+            RenderStats::frame().redundantStateCalls++;
+            return;
+        }
+
+        if (enabled)
+        {
+            glEnable(capability);
+        }
+        else
+        {
+            glDisable(capability);
+        }
+        capabilities[capability] = (GLboolean)enabled;
+    }
+
+    // Deleting a bound object reverts the binding to 0
+    void forgetProgram(GLuint handle)
+    {
+        forget(program, handle);
+    }
+
+    void forgetVertexArray(GLuint handle)
+    {
+        forget(vertexArray, handle);
+    }
+
+    void forgetBuffer(GLuint handle)
+    {
+        forget(arrayBuffer, handle);
+        forget(elementArrayBuffer, handle);
+    }
+
+    void forgetTexture(GLuint handle)
+    {
+        for(GLuint unit = 0; unit < MaxTextureUnits; ++unit)
+        {
+            forget(textures2D[unit], handle);
+            forget(textures2DArray[unit], handle);
+        }
+    }
+
+    GLuint *bufferBinding(GLenum target)
+    {
+        switch(target)
+        {
+        case GL_ARRAY_BUFFER:         return &arrayBuffer;
+        case GL_ELEMENT_ARRAY_BUFFER: return &elementArrayBuffer;
+        }
+        return NULL;
+    }
+
+    bool changed(GLuint &shadow, GLuint value)
+    {
+        if (shadow == value)
+        {
+            RenderStats::frame().redundantStateCalls++;
+            return false;
+        }
+        shadow = value;
+        return true;
+    }
+
+    void forget(GLuint &shadow, GLuint handle)
+    {
+        if (shadow == handle)
+        {
+            shadow = 0;
+        }
+    }
+};
+
+#endif // GLSTATE_H
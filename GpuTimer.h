@@ -0,0 +1,99 @@
+#ifndef GPUTIMER_H
+#define GPUTIMER_H
+
+#include <glad/glad.h>
+
+// GL_TIME_ELAPSED query measuring how long the GPU spends on the commands
+// between begin() and end(). Like OcclusionQuery, results are only read
+// once available, a few frames late, so measuring never stalls the CPU.
+// Every measurement carries a tag so late results can still be attributed
+// to what was measured.
+struct GpuTimer
+{
+    static const int Latency = 3;
+
+    GLuint queries[Latency] = {};
+    int tags[Latency] = {};
+    bool pending[Latency] = {};
+    bool active = false;
+    int next = 0;
+
+    // Latest result
+    float milliseconds = 0.0f;
+    int tag = 0;
+
+    // Requires GL 3.3, not available on GLES/WebGL without extensions
+    static bool supported()
+    {
+        return GLAD_GL_VERSION_3_3 && glGenQueries != NULL && glGetQueryObjectui64v != NULL;
+    }
+
+    // Must be called while the context is still alive.
+    void release()
+    {
+        if (queries[0])
+        {
+            glDeleteQueries(Latency, queries);
+        }
+        *this = GpuTimer();
+    }
+
+    // Returns true when a new result arrived, oldest first.
+    bool poll()
+    {
+        for(int i = 0; i < Latency; ++i)
+        {
+            int slot = (next + i) % Latency;
+            if (!pending[slot])
+            {
+                continue;
+            }
+
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                return false;
+            }
+
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &nanoseconds);
+            milliseconds = nanoseconds / 1000000.0f;
+            tag = tags[slot];
+            pending[slot] = false;
+            return true;
+        }
+        return false;
+    }
+
+    void begin(int measurementTag)
+    {
+        if (!queries[0])
+        {
+            glGenQueries(Latency, queries);
+        }
+
+        // Every query still in flight, skip this measurement
+        active = !pending[next];
+        if (active)
+        {
+            tags[next] = measurementTag;
+            glBeginQuery(GL_TIME_ELAPSED, queries[next]);
+        }
+    }
+
+    void end()
+    {
+        if (!active)
+        {
+            return;
+        }
+
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[next] = true;
+        next = (next + 1) % Latency;
+        active = false;
+    }
+};
+
+#endif // GPUTIMER_H
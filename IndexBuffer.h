@@ -0,0 +1,153 @@
+#ifndef INDEXBUFFER_H
+#define INDEXBUFFER_H
+
+#include <cassert>
+#include <vector>
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+
+struct IndexBuffer
+{
+    enum Hint
+    {
+        Stream  = GL_STREAM_DRAW,
+        Static  = GL_STATIC_DRAW,
+        Dynamic = GL_DYNAMIC_DRAW
+    };
+
+    enum Type
+    {
+        UnsignedShort = GL_UNSIGNED_SHORT,
+        UnsignedInt   = GL_UNSIGNED_INT
+    };
+
+    GLuint handle = 0;
+    Type type = UnsignedShort;
+    GLsizei count = 0;
+
+    IndexBuffer()
+    {
+        glGenBuffers(1, &handle);
+    }
+
+    ~IndexBuffer()
+    {
+        GLState::current().forgetBuffer(handle);
+        glDeleteBuffers(1, &handle);
+        handle = 0;
+    }
+
+    GLsizei sizeOfType()
+    {
+        switch(type)
+        {
+        case UnsignedShort: return sizeof(GLushort);
+        case UnsignedInt:   return sizeof(GLuint);
+        }
+        assert(false);
+        return 0;
+    }
+
+    // Byte offset of the index number first, to pass to glDrawElements()
+    const GLvoid *offsetOf(GLsizei first)
+    {
+        return reinterpret_cast<const GLvoid*>((size_t)first * sizeOfType());
+    }
+
+    void bind()
+    {
+        GLState::current().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, handle);
+    }
+
+    void unbind()
+    {
+        GLState::current().bindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    }
+
+    void upload(const std::vector<GLushort> &indices, Hint hint)
+    {
+        type = UnsignedShort;
+        count = (GLsizei)indices.size();
+        bind();
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLushort) * indices.size(), indices.data(), hint);
+    }
+
+    void upload(const std::vector<GLuint> &indices, Hint hint)
+    {
+        type = UnsignedInt;
+        count = (GLsizei)indices.size();
+        bind();
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * indices.size(), indices.data(), hint);
+    }
+
+    // Shared index buffer drawing quads of 4 vertices given in
+    // GL_TRIANGLE_STRIP order as 6 GL_TRIANGLES indices each. Built on first
+    // use and grown when more quads are requested. Uses 16-bit indices while
+    // the vertices fit, 32-bit ones beyond 16384 quads.
+    static IndexBuffer *quads(GLsizei quadCount)
+    {
+        IndexBuffer *&shared = sharedQuads();
+        if (shared && shared->count >= quadCount * 6)
+        {
+            return shared;
+        }
+
+        GLsizei capacity = shared ? shared->count / 6 : 0;
+        while (capacity < quadCount)
+        {
+            capacity = capacity ? capacity * 2 : 1024;
+        }
+
+        if (!shared)
+        {
+            shared = new IndexBuffer();
+        }
+
+        if (capacity * 4 <= 65536)
+        {
+            shared->upload(quadIndices<GLushort>(capacity), Static);
+        }
+        else
+        {
+            shared->upload(quadIndices<GLuint>(capacity), Static);
+        }
+
+        return shared;
+    }
+
+    // Must be called before the GL context goes away.
+    static void releaseShared()
+    {
+        delete sharedQuads();
+        sharedQuads() = NULL;
+    }
+
+    static IndexBuffer *&sharedQuads()
+    {
+        static IndexBuffer *shared = NULL;
+        return shared;
+    }
+
+    template<typename Index>
+    static std::vector<Index> quadIndices(GLsizei quadCount)
+    {
+        std::vector<Index> indices;
+        indices.reserve(quadCount * 6);
+        for(GLsizei i = 0; i < quadCount; ++i)
+        {
+            // Strip (0, 1, 2, 3) as the triangles (0, 1, 2) and (2, 1, 3)
+            Index v = (Index)(i * 4);
+            indices.push_back(v + 0);
+            indices.push_back(v + 1);
+            indices.push_back(v + 2);
+            indices.push_back(v + 2);
+            indices.push_back(v + 1);
+            indices.push_back(v + 3);
+        }
+        return indices;
+    }
+};
+
+#endif // INDEXBUFFER_H
@@ -0,0 +1,275 @@
+#ifndef INDIRECTBATCH_H
+#define INDIRECTBATCH_H
+
+#include <cassert>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "IndexBuffer.h"
+#include "RenderStats.h"
+#include "ShaderProgram.h"
+#include "SpriteBatch.h"
+#include "Texture.h"
+#include "VertexBuffer.h"
+
+// Collapses per-object quad draws into a handful of API calls.
+//
+// Meshes are registered once into a shared vertex pool. Every draw() appends
+// a model matrix to a transform stream and a command to a
+// GL_DRAW_INDIRECT_BUFFER whose base instance points at that matrix. At end()
+// consecutive draws sharing a texture and depth layer are submitted with one
+// glMultiDrawElementsIndirect (GL 4.3).
+//
+// Without it, the quads are transformed on the CPU and every group goes
+// through glMultiDrawArrays instead, or a glDrawArrays loop on GLES.
+struct IndirectBatch
+{
+    // Layout defined by GL, see glMultiDrawElementsIndirect
+    struct DrawElementsIndirectCommand
+    {
+        GLuint count;
+        GLuint instanceCount;
+        GLuint firstIndex;
+        GLint baseVertex;
+        GLuint baseInstance;
+    };
+
+    struct Mesh
+    {
+        GLint baseVertex;
+        GLsizei vertexCount;
+    };
+
+    struct Group
+    {
+        Texture *texture;
+        float depthLayer;
+        size_t first;
+        GLsizei count;
+    };
+
+    VertexBuffer *meshVBO = NULL;
+    std::vector<SpriteVertex> meshVertices;
+    std::vector<Mesh> meshes;
+    bool meshesDirty = false;
+
+    // glMultiDrawElementsIndirect path: a_model per instance, u_depthLayer
+    ShaderProgram *program = NULL;
+    GLint u_depthLayer = -1;
+    VertexBuffer *transformVBO = NULL;
+    GLuint indirectBuffer = 0;
+
+    // glMultiDrawArrays path: pre-transformed vertices, u_model and u_depthLayer
+    ShaderProgram *fallbackProgram = NULL;
+    GLint u_fallbackModel = -1;
+    GLint u_fallbackDepthLayer = -1;
+    VertexBuffer *fallbackVBO = NULL;
+    std::vector<SpriteVertex> fallbackVertices;
+    std::vector<GLint> fallbackFirsts;
+    std::vector<GLsizei> fallbackCounts;
+
+    std::vector<glm::mat4> models;
+    std::vector<GLint> drawMeshes;
+    std::vector<DrawElementsIndirectCommand> commands;
+    std::vector<Group> groups;
+
+    IndirectBatch()
+    {
+        meshVBO = new VertexBuffer();
+        transformVBO = new VertexBuffer();
+        fallbackVBO = new VertexBuffer();
+        if (supported())
+        {
+            glGenBuffers(1, &indirectBuffer);
+        }
+    }
+
+    ~IndirectBatch()
+    {
+        delete meshVBO;
+        meshVBO = NULL;
+
+        delete transformVBO;
+        transformVBO = NULL;
+
+        delete fallbackVBO;
+        fallbackVBO = NULL;
+
+        if (indirectBuffer)
+        {
+            glDeleteBuffers(1, &indirectBuffer);
+            indirectBuffer = 0;
+        }
+    }
+
+    static bool supported()
+    {
+        return glMultiDrawElementsIndirect != NULL && glVertexAttribDivisor != NULL;
+    }
+
+    bool usesIndirect()
+    {
+        return indirectBuffer && program;
+    }
+
+    void setPrograms(ShaderProgram *instancedProgram, GLint depthLayerLocation,
+                     ShaderProgram *perDrawProgram, GLint modelLocation, GLint perDrawDepthLayerLocation)
+    {
+        program = instancedProgram;
+        u_depthLayer = depthLayerLocation;
+        fallbackProgram = perDrawProgram;
+        u_fallbackModel = modelLocation;
+        u_fallbackDepthLayer = perDrawDepthLayerLocation;
+    }
+
+    // quad is 4 vertices in GL_TRIANGLE_STRIP order. Returns the mesh id to draw it with.
+    template<typename Vertex>
+    GLint addMesh(const std::vector<Vertex> &quad)
+    {
+        assert(quad.size() == 4);
+
+        Mesh mesh = { (GLint)meshVertices.size(), (GLsizei)quad.size() };
+        for(size_t i = 0; i < quad.size(); ++i)
+        {
+            SpriteVertex v;
+            v.position = quad[i].position;
+            v.texCoord = quad[i].texCoord;
+            meshVertices.push_back(v);
+        }
+
+        meshes.push_back(mesh);
+        meshesDirty = true;
+        return (GLint)meshes.size() - 1;
+    }
+
+    void draw(GLint mesh, Texture *texture, const glm::mat4 &model, float depthLayer)
+    {
+        if (groups.empty() || groups.back().texture != texture || groups.back().depthLayer != depthLayer)
+        {
+            Group group = { texture, depthLayer, models.size(), 0 };
+            groups.push_back(group);
+        }
+
+        groups.back().count++;
+        models.push_back(model);
+        drawMeshes.push_back(mesh);
+    }
+
+    void end()
+    {
+        if (meshesDirty)
+        {
+            meshVBO->upload(meshVertices, VertexBuffer::Static);
+            meshesDirty = false;
+        }
+
+        if (!models.empty())
+        {
+            if (usesIndirect())
+            {
+                submitIndirect();
+            }
+            else
+            {
+                submitFallback();
+            }
+        }
+
+        models.clear();
+        drawMeshes.clear();
+        groups.clear();
+    }
+
+    void submitIndirect()
+    {
+        // One command per object, its base instance fetches its model matrix
+        commands.resize(models.size());
+        for(size_t i = 0; i < models.size(); ++i)
+        {
+            const Mesh &mesh = meshes[drawMeshes[i]];
+            DrawElementsIndirectCommand &command = commands[i];
+            command.count = 6;
+            command.instanceCount = 1;
+            command.firstIndex = 0;
+            command.baseVertex = mesh.baseVertex;
+            command.baseInstance = (GLuint)i;
+        }
+
+        IndexBuffer *indices = IndexBuffer::quads(1);
+
+        transformVBO->upload(models, VertexBuffer::Stream);
+        GLState::current().bindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, sizeof(DrawElementsIndirectCommand) * commands.size(), commands.data(), GL_STREAM_DRAW);
+
+        program->bind();
+        meshVBO->bind(program);
+        transformVBO->bindInstances(program);
+        indices->bind();
+
+        for(size_t i = 0; i < groups.size(); ++i)
+        {
+            const Group &group = groups[i];
+            group.texture->bind();
+            program->setUniform(u_depthLayer, group.depthLayer);
+            glMultiDrawElementsIndirect(GL_TRIANGLES, indices->type, reinterpret_cast<const GLvoid*>(group.first * sizeof(DrawElementsIndirectCommand)), group.count, 0);
+            RenderStats::frame().drawCalls++;
+        }
+
+        RenderStats::frame().indirectDraws += (int)commands.size();
+    }
+
+    void submitFallback()
+    {
+        // Without base instance, transform the quads on the CPU and draw every
+        // object of a group as its own strip of the same call.
+        fallbackVertices.resize(models.size() * 4);
+        fallbackFirsts.resize(models.size());
+        fallbackCounts.resize(models.size());
+        for(size_t i = 0; i < models.size(); ++i)
+        {
+            const Mesh &mesh = meshes[drawMeshes[i]];
+            for(GLsizei v = 0; v < mesh.vertexCount; ++v)
+            {
+                const SpriteVertex &src = meshVertices[mesh.baseVertex + v];
+                SpriteVertex &dst = fallbackVertices[i * 4 + v];
+                dst.position = glm::vec3(models[i] * glm::vec4(src.position, 1.0f));
+                dst.texCoord = src.texCoord;
+            }
+            fallbackFirsts[i] = (GLint)(i * 4);
+            fallbackCounts[i] = mesh.vertexCount;
+        }
+
+        fallbackProgram->bind();
+        fallbackProgram->setUniform(u_fallbackModel, glm::identity<glm::mat4>());
+        fallbackVBO->upload(fallbackVertices, VertexBuffer::Stream);
+        fallbackVBO->bind(fallbackProgram);
+
+        for(size_t i = 0; i < groups.size(); ++i)
+        {
+            const Group &group = groups[i];
+            group.texture->bind();
+            fallbackProgram->setUniform(u_fallbackDepthLayer, group.depthLayer);
+            if (glMultiDrawArrays)
+            {
+                glMultiDrawArrays(GL_TRIANGLE_STRIP, &fallbackFirsts[group.first], &fallbackCounts[group.first], group.count);
+                RenderStats::frame().drawCalls++;
+            }
+            else
+            {
+                for(GLsizei j = 0; j < group.count; ++j)
+                {
+                    glDrawArrays(GL_TRIANGLE_STRIP, fallbackFirsts[group.first + j], fallbackCounts[group.first + j]);
+                    RenderStats::frame().drawCalls++;
+                }
+            }
+        }
+
+        RenderStats::frame().indirectDraws += (int)models.size();
+    }
+};
+
+#endif // INDIRECTBATCH_H
@@ -0,0 +1,316 @@
+#ifndef KTXIMAGE_H
+#define KTXIMAGE_H
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "CompressedFormat.h"
+
+// Mip chain read from a KTX 1 or KTX 2 container holding one of the
+// CompressedFormat formats. Only 2D textures without supercompression are
+// accepted: no arrays, cube maps, Basis Universal or zstd.
+//
+// When the context can't sample the format, decompress() converts every
+// level to RGBA8 so the texture can still be uploaded. Neither touches GL,
+// both can run on a worker thread.
+struct KtxImage
+{
+    struct Level
+    {
+        int width;
+        int height;
+        size_t offset;
+        size_t size;
+    };
+
+    std::string filePath;
+    const CompressedFormat *format = NULL; // NULL once decompressed to RGBA8
+    std::vector<Level> levels;
+    std::vector<uint8_t> data;
+
+    static bool isKtx(const std::string &filePath)
+    {
+        size_t dot = filePath.rfind('.');
+        return dot != std::string::npos && (filePath.compare(dot, std::string::npos, ".ktx") == 0 ||
+                                             filePath.compare(dot, std::string::npos, ".ktx2") == 0);
+    }
+
+    int width() const
+    {
+        return levels.empty() ? 0 : levels[0].width;
+    }
+
+    int height() const
+    {
+        return levels.empty() ? 0 : levels[0].height;
+    }
+
+    const uint8_t *levelData(int level) const
+    {
+        return data.data() + levels[level].offset;
+    }
+
+    // Reads the whole file. Returns 0 on success.
+    int load(const std::string &path)
+    {
+        filePath = path;
+        format = NULL;
+        levels.clear();
+        data.clear();
+
+        std::vector<uint8_t> file;
+        if (readFile(path, file) != 0)
+        {
+            return -1;
+        }
+
+        static const uint8_t ktx1Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '1', '1', 0xBB, '\r', '\n', 0x1A, '\n' };
+        static const uint8_t ktx2Identifier[12] = { 0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n' };
+        if (file.size() >= 12 && memcmp(file.data(), ktx1Identifier, 12) == 0)
+        {
+            return parseKtx1(file);
+        }
+        if (file.size() >= 12 && memcmp(file.data(), ktx2Identifier, 12) == 0)
+        {
+            return parseKtx2(file);
+        }
+
+        SDL_LogCritical(0, "%s is not a KTX file", path.c_str());
+        return -1;
+    }
+
+    // Reads only the format of path, cheap enough to pick between variants.
+    static const CompressedFormat *peekFormat(const std::string &path)
+    {
+        SDL_RWops *file = SDL_RWFromFile(path.c_str(), "rb");
+        if (file == NULL)
+        {
+            return NULL;
+        }
+
+        uint8_t header[32] = {};
+        size_t read = SDL_RWread(file, header, 1, sizeof(header));
+        SDL_RWclose(file);
+        if (read < sizeof(header) || memcmp(header, "\xABKTX ", 5) != 0)
+        {
+            return NULL;
+        }
+
+        // glInternalFormat for KTX 1, vkFormat for KTX 2
+        return header[5] == '1' ? CompressedFormat::findGL(readU32(header + 28)) : CompressedFormat::findVk(readU32(header + 12));
+    }
+
+    // Returns the variant whose format the context samples and ranks
+    // highest, otherwise the first one with a CPU decoder, otherwise "".
+    static std::string pickVariant(const std::vector<std::string> &paths)
+    {
+        std::string best;
+        int bestPreference = 0;
+        std::string fallback;
+        for(size_t i = 0; i < paths.size(); ++i)
+        {
+            const CompressedFormat *format = peekFormat(paths[i]);
+            if (format == NULL)
+            {
+                continue;
+            }
+
+            if (format->available && CompressedFormat::preference(format) > bestPreference)
+            {
+                best = paths[i];
+                bestPreference = CompressedFormat::preference(format);
+            }
+            else if (fallback.empty() && format->decodeBlock)
+            {
+                fallback = paths[i];
+            }
+        }
+        return best.empty() ? fallback : best;
+    }
+
+    // Replaces the compressed levels by RGBA8 ones. Returns 0 on success.
+    int decompress()
+    {
+        if (format == NULL)
+        {
+            return 0;
+        }
+        if (format->decodeBlock == NULL)
+        {
+            SDL_LogCritical(0, "No CPU decoder for %s (%s)", format->name, filePath.c_str());
+            return -1;
+        }
+
+        std::vector<uint8_t> rgba;
+        std::vector<Level> rgbaLevels;
+        for(size_t level = 0; level < levels.size(); ++level)
+        {
+            Level l = levels[level];
+            size_t offset = rgba.size();
+            rgba.resize(offset + (size_t)l.width * l.height * 4);
+            format->decode(levelData((int)level), l.width, l.height, rgba.data() + offset);
+
+            l.offset = offset;
+            l.size = rgba.size() - offset;
+            rgbaLevels.push_back(l);
+        }
+
+        data.swap(rgba);
+        levels.swap(rgbaLevels);
+        format = NULL;
+        return 0;
+    }
+
+    static uint32_t readU32(const uint8_t *p)
+    {
+        return (uint32_t)p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    static uint64_t readU64(const uint8_t *p)
+    {
+        return readU32(p) | (uint64_t)readU32(p + 4) << 32;
+    }
+
+    static int readFile(const std::string &path, std::vector<uint8_t> &file)
+    {
+        SDL_RWops *rw = SDL_RWFromFile(path.c_str(), "rb");
+        if (rw == NULL)
+        {
+            SDL_LogCritical(0, "Unable to open %s: %s", path.c_str(), SDL_GetError());
+            return -1;
+        }
+
+        Sint64 size = SDL_RWsize(rw);
+        file.resize(size > 0 ? (size_t)size : 0);
+        size_t read = file.empty() ? 0 : SDL_RWread(rw, file.data(), 1, file.size());
+        SDL_RWclose(rw);
+        if (size <= 0 || read != file.size())
+        {
+            SDL_LogCritical(0, "Unable to read %s", path.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    // Checks the chain is complete: level n is 4x4 blocks of max(1, size >> n).
+    int addLevel(const std::vector<uint8_t> &file, int width, int height, uint64_t offset, uint64_t size)
+    {
+        int level = (int)levels.size();
+        Level l;
+        l.width = width >> level > 0 ? width >> level : 1;
+        l.height = height >> level > 0 ? height >> level : 1;
+        l.offset = data.size();
+        l.size = CompressedFormat::levelByteCount(format->blockBytes, l.width, l.height);
+
+        if (size != l.size || offset + size > file.size())
+        {
+            SDL_LogCritical(0, "Level %d of %s is truncated or has the wrong size", level, filePath.c_str());
+            return -1;
+        }
+
+        data.insert(data.end(), file.begin() + (size_t)offset, file.begin() + (size_t)(offset + size));
+        levels.push_back(l);
+        return 0;
+    }
+
+    int checkHeader(int width, int height, uint32_t depth, uint32_t layers, uint32_t faces, uint32_t levelCount)
+    {
+        if (format == NULL)
+        {
+            SDL_LogCritical(0, "%s uses an unsupported format", filePath.c_str());
+            return -1;
+        }
+        if (width <= 0 || height <= 0 || depth > 1 || layers > 1 || faces != 1 || levelCount > 16)
+        {
+            SDL_LogCritical(0, "%s is not a single 2D texture", filePath.c_str());
+            return -1;
+        }
+        return 0;
+    }
+
+    int parseKtx1(const std::vector<uint8_t> &file)
+    {
+        const size_t headerSize = 64;
+        if (file.size() < headerSize || readU32(file.data() + 12) != 0x04030201)
+        {
+            SDL_LogCritical(0, "%s has a truncated header or foreign endianness", filePath.c_str());
+            return -1;
+        }
+
+        const uint8_t *header = file.data();
+        format = CompressedFormat::findGL(readU32(header + 28));
+        int width = (int)readU32(header + 36);
+        int height = (int)readU32(header + 40);
+        uint32_t levelCount = readU32(header + 56);
+        if (checkHeader(width, height, readU32(header + 44), readU32(header + 48), readU32(header + 52), levelCount) != 0)
+        {
+            return -1;
+        }
+
+        // Every level is preceded by its size and padded to 4 bytes
+        uint64_t offset = headerSize + readU32(header + 60);
+        for(uint32_t level = 0; level < (levelCount ? levelCount : 1); ++level)
+        {
+            if (offset + 4 > file.size())
+            {
+                SDL_LogCritical(0, "%s is truncated", filePath.c_str());
+                return -1;
+            }
+            uint32_t size = readU32(file.data() + offset);
+            if (addLevel(file, width, height, offset + 4, size) != 0)
+            {
+                return -1;
+            }
+            offset += 4 + ((size + 3) & ~3u);
+        }
+        return 0;
+    }
+
+    int parseKtx2(const std::vector<uint8_t> &file)
+    {
+        const size_t headerSize = 80;
+        if (file.size() < headerSize)
+        {
+            SDL_LogCritical(0, "%s has a truncated header", filePath.c_str());
+            return -1;
+        }
+
+        const uint8_t *header = file.data();
+        format = CompressedFormat::findVk(readU32(header + 12));
+        int width = (int)readU32(header + 20);
+        int height = (int)readU32(header + 24);
+        uint32_t levelCount = readU32(header + 40);
+        if (readU32(header + 44) != 0)
+        {
+            SDL_LogCritical(0, "%s is supercompressed, only plain KTX 2 files are supported", filePath.c_str());
+            return -1;
+        }
+        if (checkHeader(width, height, readU32(header + 28), readU32(header + 32), readU32(header + 36), levelCount) != 0)
+        {
+            return -1;
+        }
+
+        // Level index follows the header, largest level first
+        levelCount = levelCount ? levelCount : 1;
+        if (file.size() < headerSize + levelCount * 24)
+        {
+            SDL_LogCritical(0, "%s has a truncated level index", filePath.c_str());
+            return -1;
+        }
+        for(uint32_t level = 0; level < levelCount; ++level)
+        {
+            const uint8_t *entry = header + headerSize + level * 24;
+            if (addLevel(file, width, height, readU64(entry), readU64(entry + 8)) != 0)
+            {
+                return -1;
+            }
+        }
+        return 0;
+    }
+};
+
+#endif // KTXIMAGE_H
@@ -0,0 +1,120 @@
+#ifndef OCCLUSIONQUERY_H
+#define OCCLUSIONQUERY_H
+
+#include <glad/glad.h>
+
+#include "RenderStats.h"
+
+// GL_ANY_SAMPLES_PASSED query tracking whether something drawn last frame
+// was visible. Results are only read once the GPU reports them available,
+// so the CPU never waits: queries rotate through a small ring and the most
+// recent available answer is used. Until a first answer comes back the
+// object counts as visible.
+struct OcclusionQuery
+{
+    static const int Latency = 3;
+
+    GLuint queries[Latency] = {};
+    bool pending[Latency] = {};
+    int next = 0;
+    int last = -1;
+    bool visible = true;
+
+    // Must be called while the context is still alive.
+    void release()
+    {
+        if (queries[0])
+        {
+            glDeleteQueries(Latency, queries);
+        }
+        *this = OcclusionQuery();
+    }
+
+    // Requires GL 3.3 or GLES 3.0
+    static bool supported()
+    {
+        return (GLAD_GL_VERSION_3_3 || GLAD_GL_ES_VERSION_3_0) && glGenQueries != NULL;
+    }
+
+    // Picks up results that arrived since the last call, oldest first.
+    void poll()
+    {
+        for(int i = 0; i < Latency; ++i)
+        {
+            int slot = (next + i) % Latency;
+            if (!pending[slot])
+            {
+                continue;
+            }
+
+            GLuint available = GL_FALSE;
+            glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available)
+            {
+                // Queries complete in order, the newer ones are not ready either
+                break;
+            }
+
+            GLuint samplesPassed = GL_FALSE;
+            glGetQueryObjectuiv(queries[slot], GL_QUERY_RESULT, &samplesPassed);
+            visible = samplesPassed != GL_FALSE;
+            pending[slot] = false;
+        }
+    }
+
+    // True when the latest known result says nothing passed the depth test.
+    bool occluded()
+    {
+        poll();
+        return !visible;
+    }
+
+    // Starts measuring the next draws. Returns false when every query of the
+    // ring is still in flight, in which case end() must not be called.
+    bool begin()
+    {
+        if (!queries[0])
+        {
+            glGenQueries(Latency, queries);
+        }
+
+        if (pending[next])
+        {
+            return false;
+        }
+
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, queries[next]);
+        return true;
+    }
+
+    void end()
+    {
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        RenderStats::frame().occlusionQueries++;
+
+        pending[next] = true;
+        last = next;
+        next = (next + 1) % Latency;
+    }
+
+    // When the CPU has no answer yet for the latest query, let the GPU
+    // discard the next draws if it already knows they are hidden.
+    // GL_QUERY_NO_WAIT draws normally when the GPU does not know either.
+    bool beginConditional()
+    {
+        if (glBeginConditionalRender == NULL || last < 0 || !pending[last])
+        {
+            return false;
+        }
+
+        glBeginConditionalRender(queries[last], GL_QUERY_NO_WAIT);
+        return true;
+    }
+
+    void endConditional()
+    {
+        glEndConditionalRender();
+    }
+};
+
+#endif // OCCLUSIONQUERY_H
@@ -0,0 +1,79 @@
+#ifndef PERVIEW_H
+#define PERVIEW_H
+
+#include <cstring>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "Shader.h"
+
+// Camera state shared by every shader program. Matches the std140 layout of
+// the PerView uniform block declared by the vertex shaders.
+struct PerView
+{
+    glm::mat4 projection;
+    glm::vec4 viewport; // xy: display size, zw: vanish point
+};
+
+// Holds the PerView values of the frame in a uniform buffer bound at a fixed
+// binding point, which every ShaderProgram attaches its PerView block to.
+// Without uniform buffers (WebGL 1) programs pick the values up as plain
+// uniforms when they are bound instead, see ShaderProgram::bind().
+struct PerViewBuffer
+{
+    static const GLuint Binding = 0;
+
+    GLuint handle = 0;
+    PerView data;
+    unsigned version = 0;
+
+    static PerViewBuffer &shared()
+    {
+        static PerViewBuffer buffer;
+        return buffer;
+    }
+
+    // Call once per frame, before drawing. Uploads only when a value changed.
+    void update(const PerView &view)
+    {
+        if (version > 0 && memcmp(&view, &data, sizeof(PerView)) == 0)
+        {
+            return;
+        }
+
+        data = view;
+        version++;
+
+        if (!Shader::hasUniformBuffers())
+        {
+            return;
+        }
+
+        if (!handle)
+        {
+            glGenBuffers(1, &handle);
+            GLState::current().bindBuffer(GL_UNIFORM_BUFFER, handle);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(PerView), NULL, GL_DYNAMIC_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, Binding, handle);
+        }
+
+        GLState::current().bindBuffer(GL_UNIFORM_BUFFER, handle);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(PerView), &data);
+    }
+
+    // Must be called before the GL context goes away.
+    void release()
+    {
+        if (handle)
+        {
+            GLState::current().forgetBuffer(handle);
+            glDeleteBuffers(1, &handle);
+            handle = 0;
+        }
+        version = 0;
+    }
+};
+
+#endif // PERVIEW_H
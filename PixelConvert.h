@@ -0,0 +1,244 @@
+#ifndef PIXELCONVERT_H
+#define PIXELCONVERT_H
+
+#include <cstddef>
+#include <cstdint>
+
+#include <SDL2/SDL.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PIXELCONVERT_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// SSSE3 and AVX2 are enabled per function, the rest of the program keeps
+// its baseline ISA.
+#if defined(PIXELCONVERT_SSE2) && (defined(__GNUC__) || defined(__clang__))
+#define PIXELCONVERT_SHUFFLE 1
+#include <immintrin.h>
+#include <SDL2/SDL_cpuinfo.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define PIXELCONVERT_NEON 1
+#include <arm_neon.h>
+#endif
+
+// Converts rows of decoded pixels to the RGBA8 byte order GL expects, from
+// 3 or 4 byte sources in any channel order, optionally premultiplying
+// color by alpha. Lets the loader write SDL_image's surfaces straight into
+// upload memory instead of going through SDL_ConvertSurfaceFormat first.
+//
+// SSSE3 (byte shuffles) and AVX2 are picked at runtime on x86, NEON is
+// used whenever the target has it. SDL has no SSSE3 query, the compiler's
+// CPUID check is used for it.
+struct PixelConvert
+{
+    // Source byte of each destination channel, alpha >= sourceBytes means opaque
+    struct Layout
+    {
+        int sourceBytes;
+        int r, g, b, a;
+    };
+
+    // Formats IMG_Load returns for common JPG and PNG files. Returns false
+    // for anything else, which needs SDL_ConvertSurfaceFormat.
+    static bool layout(Uint32 format, Layout &out)
+    {
+        switch(format)
+        {
+            case SDL_PIXELFORMAT_RGB24:  out = { 3, 0, 1, 2, 3 }; return true;
+            case SDL_PIXELFORMAT_BGR24:  out = { 3, 2, 1, 0, 3 }; return true;
+            case SDL_PIXELFORMAT_RGBA32: out = { 4, 0, 1, 2, 3 }; return true;
+            case SDL_PIXELFORMAT_BGRA32: out = { 4, 2, 1, 0, 3 }; return true;
+            default: return false;
+        }
+    }
+
+    static void convertRow(const uint8_t *src, uint8_t *dst, size_t count, const Layout &layout, bool premultiply)
+    {
+        // Opaque sources have nothing to premultiply
+        premultiply = premultiply && layout.a < layout.sourceBytes;
+
+        size_t done = 0;
+#ifdef PIXELCONVERT_SHUFFLE
+        static const bool hasAVX2 = SDL_HasAVX2() != 0;
+        static const bool hasSSSE3 = __builtin_cpu_supports("ssse3") != 0; // CPUID leaf 1, ECX bit 9
+        if (hasAVX2)
+        {
+            done = convertAVX2(src, dst, count, layout);
+        }
+        else if (hasSSSE3)
+        {
+            done = convertSSSE3(src, dst, count, layout);
+        }
+#elif defined(PIXELCONVERT_NEON)
+        done = convertNEON(src, dst, count, layout);
+#endif
+        convertScalar(src + done * layout.sourceBytes, dst + done * 4, count - done, layout);
+
+        if (premultiply)
+        {
+            premultiplyRow(dst, count);
+        }
+    }
+
+    static void convertScalar(const uint8_t *src, uint8_t *dst, size_t count, const Layout &layout)
+    {
+        for(size_t i = 0; i < count; ++i, src += layout.sourceBytes, dst += 4)
+        {
+            dst[0] = src[layout.r];
+            dst[1] = src[layout.g];
+            dst[2] = src[layout.b];
+            dst[3] = layout.a < layout.sourceBytes ? src[layout.a] : 255;
+        }
+    }
+
+    // In place on RGBA8, rounds like (c * a + 127) / 255. SSE2 or NEON, with
+    // a scalar tail.
+    static void premultiplyRow(uint8_t *rgba, size_t count)
+    {
+        size_t i = 0;
+#ifdef PIXELCONVERT_SSE2
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i half = _mm_set1_epi16(128);
+        const __m128i alphaMask = _mm_set1_epi32((int)0xFF000000);
+        for(; i + 4 <= count; i += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(rgba + i * 4));
+            __m128i lo = _mm_unpacklo_epi8(pixels, zero);
+            __m128i hi = _mm_unpackhi_epi8(pixels, zero);
+            __m128i alphaLo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+            __m128i alphaHi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+
+            // x / 255 as (t + (t >> 8)) >> 8 with t = x + 128, exact for x <= 255 * 255
+            lo = _mm_add_epi16(_mm_mullo_epi16(lo, alphaLo), half);
+            hi = _mm_add_epi16(_mm_mullo_epi16(hi, alphaHi), half);
+            lo = _mm_srli_epi16(_mm_add_epi16(lo, _mm_srli_epi16(lo, 8)), 8);
+            hi = _mm_srli_epi16(_mm_add_epi16(hi, _mm_srli_epi16(hi, 8)), 8);
+
+            __m128i premultiplied = _mm_packus_epi16(lo, hi);
+            premultiplied = _mm_or_si128(_mm_andnot_si128(alphaMask, premultiplied), _mm_and_si128(alphaMask, pixels));
+            _mm_storeu_si128((__m128i*)(rgba + i * 4), premultiplied);
+        }
+#elif defined(PIXELCONVERT_NEON)
+        // Same rounding, deinterleaved so alpha is already its own vector
+        const uint16x8_t half = vdupq_n_u16(128);
+        for(; i + 8 <= count; i += 8)
+        {
+            uint8x8x4_t pixels = vld4_u8(rgba + i * 4);
+            for(int c = 0; c < 3; ++c)
+            {
+                uint16x8_t t = vaddq_u16(vmull_u8(pixels.val[c], pixels.val[3]), half);
+                pixels.val[c] = vshrn_n_u16(vaddq_u16(t, vshrq_n_u16(t, 8)), 8);
+            }
+            vst4_u8(rgba + i * 4, pixels);
+        }
+#endif
+        for(; i < count; ++i)
+        {
+            uint8_t *p = rgba + i * 4;
+            for(int c = 0; c < 3; ++c)
+            {
+                unsigned t = p[c] * p[3] + 128;
+                p[c] = (uint8_t)((t + (t >> 8)) >> 8);
+            }
+        }
+    }
+
+#ifdef PIXELCONVERT_SHUFFLE
+    // Shuffle control moving one 16 byte source lane to 4 RGBA pixels.
+    // Opaque alpha selects a zeroed byte, filled by the alpha mask after.
+    static void shuffleControl(const Layout &layout, int8_t control[16])
+    {
+        for(int p = 0; p < 4; ++p)
+        {
+            int base = p * layout.sourceBytes;
+            control[p * 4 + 0] = (int8_t)(base + layout.r);
+            control[p * 4 + 1] = (int8_t)(base + layout.g);
+            control[p * 4 + 2] = (int8_t)(base + layout.b);
+            control[p * 4 + 3] = layout.a < layout.sourceBytes ? (int8_t)(base + layout.a) : (int8_t)-128;
+        }
+    }
+
+    // 4 pixels per iteration. 3 byte sources load 16 bytes for 12, so the
+    // last pixels are left to the scalar loop.
+    __attribute__((target("ssse3")))
+    static size_t convertSSSE3(const uint8_t *src, uint8_t *dst, size_t count, const Layout &layout)
+    {
+        int8_t c[16];
+        shuffleControl(layout, c);
+        const __m128i control = _mm_setr_epi8(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]);
+        const __m128i alpha = layout.a < layout.sourceBytes ? _mm_setzero_si128() : _mm_set1_epi32((int)0xFF000000);
+
+        size_t sourceBytes = layout.sourceBytes;
+        size_t i = 0;
+        for(; i + 4 <= count && i * sourceBytes + 16 <= count * sourceBytes; i += 4)
+        {
+            __m128i pixels = _mm_loadu_si128((const __m128i*)(src + i * sourceBytes));
+            _mm_storeu_si128((__m128i*)(dst + i * 4), _mm_or_si128(_mm_shuffle_epi8(pixels, control), alpha));
+        }
+        return i;
+    }
+
+    // 8 pixels per iteration, each 128 bit lane shuffles 4 of them
+    __attribute__((target("avx2")))
+    static size_t convertAVX2(const uint8_t *src, uint8_t *dst, size_t count, const Layout &layout)
+    {
+        int8_t c[16];
+        shuffleControl(layout, c);
+        const __m256i control = _mm256_setr_epi8(c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15],
+                                                 c[0], c[1], c[2], c[3], c[4], c[5], c[6], c[7], c[8], c[9], c[10], c[11], c[12], c[13], c[14], c[15]);
+        const __m256i alpha = layout.a < layout.sourceBytes ? _mm256_setzero_si256() : _mm256_set1_epi32((int)0xFF000000);
+
+        size_t sourceBytes = layout.sourceBytes;
+        size_t i = 0;
+        for(; i + 8 <= count && (i + 4) * sourceBytes + 16 <= count * sourceBytes; i += 8)
+        {
+            __m128i first = _mm_loadu_si128((const __m128i*)(src + i * sourceBytes));
+            __m128i second = _mm_loadu_si128((const __m128i*)(src + (i + 4) * sourceBytes));
+            __m256i pixels = _mm256_inserti128_si256(_mm256_castsi128_si256(first), second, 1);
+            _mm256_storeu_si256((__m256i*)(dst + i * 4), _mm256_or_si256(_mm256_shuffle_epi8(pixels, control), alpha));
+        }
+        return i;
+    }
+#endif
+
+#ifdef PIXELCONVERT_NEON
+    // 16 pixels per iteration, deinterleaving loads do the swizzle
+    static size_t convertNEON(const uint8_t *src, uint8_t *dst, size_t count, const Layout &layout)
+    {
+        size_t i = 0;
+        for(; i + 16 <= count; i += 16)
+        {
+            uint8x16_t channels[4];
+            if (layout.sourceBytes == 3)
+            {
+                uint8x16x3_t in = vld3q_u8(src + i * 3);
+                channels[0] = in.val[0];
+                channels[1] = in.val[1];
+                channels[2] = in.val[2];
+                channels[3] = vdupq_n_u8(255);
+            }
+            else
+            {
+                uint8x16x4_t in = vld4q_u8(src + i * 4);
+                channels[0] = in.val[0];
+                channels[1] = in.val[1];
+                channels[2] = in.val[2];
+                channels[3] = in.val[3];
+            }
+
+            uint8x16x4_t out;
+            out.val[0] = channels[layout.r];
+            out.val[1] = channels[layout.g];
+            out.val[2] = channels[layout.b];
+            out.val[3] = channels[layout.a];
+            vst4q_u8(dst + i * 4, out);
+        }
+        return i;
+    }
+#endif
+};
+
+#endif // PIXELCONVERT_H
@@ -0,0 +1,218 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <cstring>
+#include <map>
+#include <stdint.h>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "RenderStats.h"
+#include "ShaderProgram.h"
+#include "Texture.h"
+#include "VertexBuffer.h"
+
+struct DrawCommand
+{
+    enum BlendMode
+    {
+        Opaque,
+        Translucent
+    };
+
+    ShaderProgram *program;
+    GLint u_model;
+    glm::mat4 model;
+    GLint u_depthLayer;
+    float depthLayer;
+    Texture *texture;
+    VertexBuffer *vbo;
+    GLenum mode;
+    GLint first;
+    GLsizei count;
+    float depth; // distance to the viewer, smaller is nearer
+    BlendMode blendMode;
+};
+
+// Records draw commands during the frame, sorts them by a packed 64-bit key
+// with a radix sort and submits them in that order.
+//
+// Translucent commands always come last, back to front, so they blend
+// correctly. The policy decides how opaque commands are ordered:
+//  - FrontToBack: nearest first to get the most out of early depth testing,
+//    commands at the same depth grouped by state.
+//  - BackToFront: painter's algorithm, for when depth testing is off.
+//  - StateSorted: grouped by program, texture then vertex buffer to
+//    minimize state changes, depth only breaks ties.
+struct RenderQueue
+{
+    enum Policy
+    {
+        FrontToBack,
+        BackToFront,
+        StateSorted
+    };
+
+    Policy policy = FrontToBack;
+    std::vector<DrawCommand> commands;
+    std::vector<uint64_t> keys;
+    std::vector<uint32_t> order;
+    std::vector<uint64_t> scratchKeys;
+    std::vector<uint32_t> scratchOrder;
+    std::map<const void*, uint32_t> stateIds;
+
+    void submit(const DrawCommand &command)
+    {
+        commands.push_back(command);
+    }
+
+    void clear()
+    {
+        commands.clear();
+    }
+
+    // Small ids for the state objects so they fit in a few bits of the key.
+    uint32_t stateId(const void *object, uint32_t bits)
+    {
+        std::map<const void*, uint32_t>::iterator it = stateIds.find(object);
+        if (it == stateIds.end())
+        {
+            it = stateIds.insert(std::make_pair(object, (uint32_t)stateIds.size())).first;
+        }
+        return it->second & ((1u << bits) - 1);
+    }
+
+    // Maps a float to 24 bits preserving order, negative values included.
+    static uint32_t depthBits(float depth)
+    {
+        uint32_t bits;
+        memcpy(&bits, &depth, sizeof(bits));
+        bits = (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+        return bits >> 8;
+    }
+
+    // Layout, from the most significant bit:
+    //  1 bit  translucent
+    // 24 bits depth (FrontToBack / BackToFront / translucent)
+    // 12 bits program, 12 bits texture, 12 bits vertex buffer
+    //  3 bits unused
+    // StateSorted swaps the depth and the state ids.
+    uint64_t makeKey(const DrawCommand &command)
+    {
+        uint64_t state = ((uint64_t)stateId(command.program, 12) << 24) |
+                         ((uint64_t)stateId(command.texture, 12) << 12) |
+                          (uint64_t)stateId(command.vbo, 12);
+        uint64_t depth = depthBits(command.depth);
+
+        if (command.blendMode == DrawCommand::Translucent)
+        {
+            return (1ull << 63) | (((~depth) & 0xFFFFFF) << 39) | (state << 3);
+        }
+
+        switch(policy)
+        {
+        case FrontToBack: return (depth << 39) | (state << 3);
+        case BackToFront: return (((~depth) & 0xFFFFFF) << 39) | (state << 3);
+        case StateSorted: return (state << 27) | (depth << 3);
+        }
+        return 0;
+    }
+
+    // LSD radix sort of the keys, 8 bits at a time. Passes where every key
+    // has the same byte are skipped, which is most of them in practice.
+    void sort()
+    {
+        size_t n = commands.size();
+        keys.resize(n);
+        order.resize(n);
+        scratchKeys.resize(n);
+        scratchOrder.resize(n);
+
+        for(size_t i = 0; i < n; ++i)
+        {
+            keys[i] = makeKey(commands[i]);
+            order[i] = (uint32_t)i;
+        }
+
+        for(int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {};
+            for(size_t i = 0; i < n; ++i)
+            {
+                histogram[(keys[i] >> shift) & 0xFF]++;
+            }
+
+            if (n == 0 || histogram[(keys[0] >> shift) & 0xFF] == n)
+            {
+                continue;
+            }
+
+            size_t offset = 0;
+            for(int digit = 0; digit < 256; ++digit)
+            {
+                size_t count = histogram[digit];
+                histogram[digit] = offset;
+                offset += count;
+            }
+
+            for(size_t i = 0; i < n; ++i)
+            {
+                size_t dst = histogram[(keys[i] >> shift) & 0xFF]++;
+                scratchKeys[dst] = keys[i];
+                scratchOrder[dst] = order[i];
+            }
+
+            keys.swap(scratchKeys);
+            order.swap(scratchOrder);
+        }
+    }
+
+    // Sorts, submits and clears the queue.
+    void execute()
+    {
+        sort();
+
+        bool blending = false;
+        int premultiplied = -1;
+        for(size_t i = 0; i < order.size(); ++i)
+        {
+            DrawCommand &command = commands[order[i]];
+
+            bool translucent = command.blendMode == DrawCommand::Translucent;
+            if (translucent != blending)
+            {
+                blending = translucent;
+                GLState::current().setEnabled(GL_BLEND, blending);
+                glDepthMask(blending ? GL_FALSE : GL_TRUE);
+            }
+
+            // Premultiplied textures already carry the source factor
+            if (blending && premultiplied != (int)command.texture->premultiplied)
+            {
+                premultiplied = (int)command.texture->premultiplied;
+                glBlendFunc(premultiplied ? GL_ONE : GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+            }
+
+            command.program->bind();
+            command.program->setUniform(command.u_model, command.model);
+            command.program->setUniform(command.u_depthLayer, command.depthLayer);
+            command.vbo->bind(command.program);
+            command.texture->bind();
+            glDrawArrays(command.mode, command.first, command.count);
+            RenderStats::frame().drawCalls++;
+        }
+
+        if (blending)
+        {
+            GLState::current().setEnabled(GL_BLEND, false);
+            glDepthMask(GL_TRUE);
+        }
+
+        clear();
+    }
+};
+
+#endif // RENDERQUEUE_H
@@ -0,0 +1,37 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+// Per-frame counters displayed in the Control Panel.
+// BaseApp resets them at the beginning of every frame.
+struct RenderStats
+{
+    int drawCalls = 0;
+    int spritesDrawn = 0;
+    int batchFlushes = 0;
+    int instancesDrawn = 0;
+    int indirectDraws = 0;
+    int streamStalls = 0;
+    int attributeCalls = 0;
+    int attributeCallsSaved = 0;
+    int redundantStateCalls = 0;
+    int uniformUploads = 0;
+    int uniformUploadsSkipped = 0;
+    int matricesUpdated = 0;
+    int objectsVisible = 0;
+    int objectsCulled = 0;
+    int occlusionQueries = 0;
+    int occlusionSkipped = 0;
+
+    static RenderStats &frame()
+    {
+        static RenderStats stats;
+        return stats;
+    }
+
+    void reset()
+    {
+        *this = RenderStats();
+    }
+};
+
+#endif // RENDERSTATS_H
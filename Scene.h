@@ -0,0 +1,183 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "TransformKernel.h"
+
+// Transform hierarchy. Nodes are stored as structure of arrays and a parent
+// is always added before its children, so the arrays are in topological
+// order and world matrices are updated in a single forward pass. Only nodes
+// whose TRSC changed, and their descendants, are recomputed.
+//
+// World matrices are composed straight from the TRSC inputs (Translate,
+// Rotate, Scale, Center, in that order) by TransformKernel, in runs of
+// consecutive siblings.
+struct Scene
+{
+    static const int NoParent = -1;
+
+    std::vector<int> parents;
+    std::vector<float> positionX, positionY, positionZ;
+    std::vector<float> rotationX, rotationY, rotationZ; // degrees, pitch (x), yaw (y), roll (z)
+    std::vector<float> scaleX, scaleY, scaleZ;
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<glm::mat4> worlds;
+    std::vector<unsigned char> dirty;   // local TRSC changed
+    std::vector<unsigned char> changed; // world recomputed by the last update()
+    size_t firstDirty = 0;
+    bool useKernel = true;
+
+    size_t size() const
+    {
+        return parents.size();
+    }
+
+    TRSCArrays arrays() const
+    {
+        TRSCArrays a = {
+            positionX.data(), positionY.data(), positionZ.data(),
+            rotationX.data(), rotationY.data(), rotationZ.data(),
+            scaleX.data(), scaleY.data(), scaleZ.data(),
+            centerX.data(), centerY.data(), centerZ.data(),
+        };
+        return a;
+    }
+
+    // Returns the new node, identity TRSC.
+    int addNode(int parent = NoParent)
+    {
+        assert(parent < (int)size());
+
+        int node = (int)size();
+        resize(node + 1);
+        parents[node] = parent;
+        markDirty(node);
+        return node;
+    }
+
+    // Removes the nodes from nodeCount on. They must not parent any node kept.
+    void truncate(size_t nodeCount)
+    {
+        resize(nodeCount);
+    }
+
+    void setTRSC(int node, const glm::vec3 &position, const glm::vec3 &rotation, const glm::vec3 &scale, const glm::vec3 &center)
+    {
+        positionX[node] = position.x;
+        positionY[node] = position.y;
+        positionZ[node] = position.z;
+        rotationX[node] = rotation.x;
+        rotationY[node] = rotation.y;
+        rotationZ[node] = rotation.z;
+        scaleX[node] = scale.x;
+        scaleY[node] = scale.y;
+        scaleZ[node] = scale.z;
+        centerX[node] = center.x;
+        centerY[node] = center.y;
+        centerZ[node] = center.z;
+        markDirty(node);
+    }
+
+    // Call after writing the TRSC arrays directly.
+    void markDirty(int node)
+    {
+        if (firstDirty >= size() || (size_t)node < firstDirty)
+        {
+            firstDirty = node;
+        }
+        dirty[node] = 1;
+    }
+
+    const glm::mat4 &world(int node) const
+    {
+        return worlds[node];
+    }
+
+    // Recomputes the world matrices of the dirty subtrees. Returns how many
+    // were recomputed, changed[] flags which ones.
+    size_t update()
+    {
+        size_t count = size();
+        std::fill(changed.begin(), changed.end(), 0);
+        if (firstDirty >= count)
+        {
+            return 0;
+        }
+
+        TRSCArrays in = arrays();
+        size_t updated = 0;
+        for(size_t i = firstDirty; i < count; )
+        {
+            if (!needsUpdate(i))
+            {
+                ++i;
+                continue;
+            }
+
+            // Siblings needing an update share the parent matrix, compose them together
+            int parent = parents[i];
+            size_t end = i + 1;
+            while (end < count && parents[end] == parent && needsUpdate(end))
+            {
+                ++end;
+            }
+
+            const glm::mat4 &parentWorld = parent != NoParent ? worlds[parent] : identity();
+            if (useKernel)
+            {
+                TransformKernel::composeTRSC(in, i, end - i, parentWorld, &worlds[i]);
+            }
+            else
+            {
+                TransformKernel::composeTRSCReference(in, i, end - i, parentWorld, &worlds[i]);
+            }
+
+            std::fill(dirty.begin() + i, dirty.begin() + end, 0);
+            std::fill(changed.begin() + i, changed.begin() + end, 1);
+            updated += end - i;
+            i = end;
+        }
+
+        firstDirty = count;
+        return updated;
+    }
+
+    bool needsUpdate(size_t node) const
+    {
+        int parent = parents[node];
+        return dirty[node] || (parent != NoParent && changed[parent]);
+    }
+
+    static const glm::mat4 &identity()
+    {
+        static const glm::mat4 m = glm::identity<glm::mat4>();
+        return m;
+    }
+
+    void resize(size_t nodeCount)
+    {
+        parents.resize(nodeCount, NoParent);
+        positionX.resize(nodeCount, 0.0f);
+        positionY.resize(nodeCount, 0.0f);
+        positionZ.resize(nodeCount, 0.0f);
+        rotationX.resize(nodeCount, 0.0f);
+        rotationY.resize(nodeCount, 0.0f);
+        rotationZ.resize(nodeCount, 0.0f);
+        scaleX.resize(nodeCount, 1.0f);
+        scaleY.resize(nodeCount, 1.0f);
+        scaleZ.resize(nodeCount, 1.0f);
+        centerX.resize(nodeCount, 0.0f);
+        centerY.resize(nodeCount, 0.0f);
+        centerZ.resize(nodeCount, 0.0f);
+        worlds.resize(nodeCount, glm::identity<glm::mat4>());
+        dirty.resize(nodeCount, 0);
+        changed.resize(nodeCount, 0);
+    }
+};
+
+#endif // SCENE_H
@@ -12,19 +12,27 @@
 struct Shader
 {
     GLuint handle = 0;
+    GLenum type = 0;
     std::string filePath;
+    std::string defines;
 
-    Shader(const std::string &filePath) : filePath(filePath)
+    // defines is inserted after the preamble, e.g. "#define TEXTURE_ARRAY 1\n"
+    Shader(const std::string &filePath, const std::string &defines = std::string()) : filePath(filePath), defines(defines)
     {
         std::string ext = filePath.substr(filePath.find_last_of(".") + 1);
 
         if (ext == "vert" || ext == "vsh")
         {
-            handle = glCreateShader(GL_VERTEX_SHADER);
+            type = GL_VERTEX_SHADER;
         }
         else if (ext == "frag" || ext == "fsh")
         {
-            handle = glCreateShader(GL_FRAGMENT_SHADER);
+            type = GL_FRAGMENT_SHADER;
+        }
+
+        if (type)
+        {
+            handle = glCreateShader(type);
         }
     }
 
@@ -51,7 +59,7 @@ struct Shader
         std::stringstream shaderStream;
         shaderStream << f.rdbuf();
 
-        std::string sourceCode = shaderStream.str();
+        std::string sourceCode = preamble(type) + defines + shaderStream.str();
 
         f.close();
 
@@ -73,6 +81,60 @@ struct Shader
 
         return 0;
     }
+
+    // GLSL version the shaders are compiled with: 150 on GL 3.2+, 300 on
+    // GLES 3.0+ (WebGL 2) and 0 for the context's default (GLSL 1.00 on
+    // WebGL 1).
+    static int glslVersion()
+    {
+        if (GLAD_GL_VERSION_3_2)
+        {
+            return 150;
+        }
+        if (GLAD_GL_ES_VERSION_3_0)
+        {
+            return 300;
+        }
+        return 0;
+    }
+
+    static bool hasUniformBuffers()
+    {
+        return glslVersion() != 0;
+    }
+
+    // Shaders are written in GLSL 1.00 syntax. On newer versions the
+    // preamble maps the removed keywords to their replacements and
+    // advertises the features shaders can rely on.
+    static std::string preamble(GLenum type)
+    {
+        std::string header;
+        switch(glslVersion())
+        {
+        case 150: header = "#version 150\n"; break;
+        case 300: header = "#version 300 es\n"; break;
+        default:  return header;
+        }
+
+        header += "#define HAS_UNIFORM_BUFFERS 1\n";
+        if (type == GL_VERTEX_SHADER)
+        {
+            header += "#define attribute in\n"
+                      "#define varying out\n";
+        }
+        else
+        {
+            if (glslVersion() == 300)
+            {
+                header += "precision mediump float;\n";
+            }
+            header += "#define varying in\n"
+                      "#define texture2D texture\n"
+                      "#define gl_FragColor fragColor\n"
+                      "out vec4 fragColor;\n";
+        }
+        return header;
+    }
 };
 
 #endif // SHADER_H
@@ -4,11 +4,16 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <cstring>
 #include <iostream>
 #include <vector>
 
 #include "AttributeInfo.h"
+#include "GLState.h"
+#include "PerView.h"
+#include "RenderStats.h"
 #include "Shader.h"
+#include "VertexArrayCache.h"
 
 struct ShaderProgram
 {
@@ -17,6 +22,15 @@ struct ShaderProgram
     std::vector<GLint> attributeLocations;
     std::vector<size_t> attributeOffsets;
     GLint vertexSize = 0;
+    GLint instanceSize = 0;
+
+    // Last value uploaded to every uniform, indexed by location.
+    std::vector<std::vector<unsigned char> > uniformValues;
+
+    // PerView fallback uniforms, when uniform buffers are not available.
+    GLint u_projection = -1;
+    GLint u_viewport = -1;
+    unsigned perViewVersion = 0;
 
     ShaderProgram(const std::vector<AttributeInfo> &attributes) :
           attributes(attributes)
@@ -28,8 +42,11 @@ struct ShaderProgram
 
     ~ShaderProgram()
     {
+        VertexArrayCache::shared().evict(this);
+
         if (handle)
         {
+            GLState::current().forgetProgram(handle);
             glDeleteProgram(handle);
             handle = 0;
         }
@@ -43,6 +60,7 @@ struct ShaderProgram
     int link()
     {
         glLinkProgram(handle);
+        uniformValues.clear();
 
         GLint linkStatus;
         glGetProgramiv(handle, GL_LINK_STATUS, &linkStatus);
@@ -55,39 +73,118 @@ struct ShaderProgram
         }
 
         vertexSize = 0;
+        instanceSize = 0;
         for(size_t i = 0; i < attributes.size(); ++i)
         {
+            // Attributes the shaders never read (the depth pre-pass ignores texture
+            // coordinates) are optimized out, but still take their place in the layout.
             attributeLocations[i] = glGetAttribLocation(handle, attributes[i].name.c_str());
             if (attributeLocations[i] == -1)
             {
-                SDL_LogCritical(0, "Could not find attribute named \"%s\" in shader program.", attributes[i].name.c_str());
-                return -1;
+                SDL_LogWarn(0, "Attribute \"%s\" is inactive in shader program, skipping it.", attributes[i].name.c_str());
             }
 
-            attributeOffsets[i] = vertexSize;
-            vertexSize += attributes[i].count * attributes[i].sizeOfType();
+            // per-vertex and per-instance attributes are fetched from two different buffers
+            if (attributes[i].divisor == 0)
+            {
+                attributeOffsets[i] = vertexSize;
+                vertexSize += attributes[i].count * attributes[i].sizeOfType();
+            }
+            else
+            {
+                attributeOffsets[i] = instanceSize;
+                instanceSize += attributes[i].count * attributes[i].sizeOfType();
+            }
         }
 
+        // Attach the PerView block to the shared binding point
+        if (Shader::hasUniformBuffers())
+        {
+            GLuint perViewBlock = glGetUniformBlockIndex(handle, "PerView");
+            if (perViewBlock != GL_INVALID_INDEX)
+            {
+                glUniformBlockBinding(handle, perViewBlock, PerViewBuffer::Binding);
+            }
+        }
+        else
+        {
+            u_projection = glGetUniformLocation(handle, "u_projection");
+            u_viewport   = glGetUniformLocation(handle, "u_viewport");
+            perViewVersion = 0;
+        }
 
         return 0;
     }
 
+    // With VAOs the enabled arrays are part of the cached vertex array state,
+    // see VertexBuffer::bind(). Otherwise they are toggled with the program.
     void bind()
     {
-        glUseProgram(handle);
+        GLState::current().useProgram(handle);
+
+        // Plain uniform fallback for the PerView block
+        PerViewBuffer &perView = PerViewBuffer::shared();
+        if (!Shader::hasUniformBuffers() && perViewVersion != perView.version)
+        {
+            setUniform(u_projection, perView.data.projection);
+            setUniform(u_viewport, perView.data.viewport);
+            perViewVersion = perView.version;
+        }
+
+        if (VertexArrayCache::supported())
+        {
+            return;
+        }
+
         for(size_t i = 0; i < attributeLocations.size(); ++i)
         {
-            glEnableVertexAttribArray(attributeLocations[i]);
+            for(GLint column = 0; column < activeLocationCount(i); ++column)
+            {
+                glEnableVertexAttribArray(attributeLocations[i] + column);
+            }
         }
     }
 
     void unbind()
     {
-        for(size_t i = 0; i < attributeLocations.size(); ++i)
+        if (!VertexArrayCache::supported())
         {
-            glDisableVertexAttribArray(attributeLocations[i]);
+            for(size_t i = 0; i < attributeLocations.size(); ++i)
+            {
+                for(GLint column = 0; column < activeLocationCount(i); ++column)
+                {
+                    glDisableVertexAttribArray(attributeLocations[i] + column);
+                }
+            }
         }
-        glUseProgram(0);
+        GLState::current().useProgram(0);
+    }
+
+    // 0 for attributes the linker dropped
+    GLint activeLocationCount(size_t attribute)
+    {
+        return attributeLocations[attribute] == -1 ? 0 : attributes[attribute].locationCount();
+    }
+
+    bool hasInstancedAttributes() const
+    {
+        return instanceSize > 0;
+    }
+
+    // Number of GL calls needed to specify the per-vertex or per-instance attributes.
+    int attributeCallCount(bool perInstance)
+    {
+        // glVertexAttribPointer, plus the calls VertexBuffer::bindAttributes() actually makes
+        int callsPerLocation = 1 + (VertexArrayCache::supported() ? 1 : 0) + (glVertexAttribDivisor ? 1 : 0);
+        int calls = 1; // glBindBuffer
+        for(size_t i = 0; i < attributes.size(); ++i)
+        {
+            if ((attributes[i].divisor != 0) == perInstance)
+            {
+                calls += activeLocationCount(i) * callsPerLocation;
+            }
+        }
+        return calls;
     }
 
     GLint getUniformLocation(const char *uniformName)
@@ -100,114 +197,215 @@ struct ShaderProgram
         return location;
     }
 
+    // Returns false when value is what the uniform already holds, so the
+    // upload can be skipped. Uniform values belong to the program, so this
+    // stays valid while other programs are bound.
+    bool uniformChanged(int32_t uniformLocation, const void *value, size_t size)
+    {
+        if (uniformLocation < 0)
+        {
+            return false;
+        }
+
+        // Drivers hand out small locations, don't cache anything unusual.
+        if (uniformLocation >= 4096)
+        {
+            RenderStats::frame().uniformUploads++;
+            return true;
+        }
+
+        if ((size_t)uniformLocation >= uniformValues.size())
+        {
+            uniformValues.resize(uniformLocation + 1);
+        }
+
+        std::vector<unsigned char> &cached = uniformValues[uniformLocation];
+        if (cached.size() == size && memcmp(cached.data(), value, size) == 0)
+        {
+            RenderStats::frame().uniformUploadsSkipped++;
+            return false;
+        }
+
+        const unsigned char *bytes = static_cast<const unsigned char*>(value);
+        cached.assign(bytes, bytes + size);
+        RenderStats::frame().uniformUploads++;
+        return true;
+    }
+
     void setUniform(int32_t uniformLocation, float value)
     {
-        glUniform1f(uniformLocation, value);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform1f(uniformLocation, value);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::vec2 &value)
     {
-        glUniform2f(uniformLocation, value.x, value.y);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform2f(uniformLocation, value.x, value.y);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::vec3 &value)
     {
-        glUniform3f(uniformLocation, value.x, value.y, value.z);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform3f(uniformLocation, value.x, value.y, value.z);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::vec4 &value)
     {
-        glUniform4f(uniformLocation, value.x, value.y, value.z, value.w);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform4f(uniformLocation, value.x, value.y, value.z, value.w);
+        }
     }
 
     void setUniform(int32_t uniformLocation, int32_t value)
     {
-        glUniform1i(uniformLocation, value);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform1i(uniformLocation, value);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::ivec2 &value)
     {
-        glUniform2i(uniformLocation, value.x, value.y);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform2i(uniformLocation, value.x, value.y);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::ivec3 &value)
     {
-        glUniform3i(uniformLocation, value.x, value.y, value.z);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform3i(uniformLocation, value.x, value.y, value.z);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::ivec4 &value)
     {
-        glUniform4i(uniformLocation, value.x, value.y, value.z, value.w);
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniform4i(uniformLocation, value.x, value.y, value.z, value.w);
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::mat2 &value)
     {
-        glUniformMatrix2fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniformMatrix2fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::mat3 &value)
     {
-        glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniformMatrix3fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const glm::mat4 &value)
     {
-        glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        if (uniformChanged(uniformLocation, &value, sizeof(value)))
+        {
+            glUniformMatrix4fv(uniformLocation, 1, GL_FALSE, glm::value_ptr(value));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<float> &values)
     {
-        glUniform1fv(uniformLocation, (GLsizei)values.size(), values.data());
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform1fv(uniformLocation, (GLsizei)values.size(), values.data());
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::vec2> &values)
     {
-        glUniform2fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform2fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::vec3> &values)
     {
-        glUniform3fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform3fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::vec4> &values)
     {
-        glUniform4fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform4fv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<int32_t> &values)
     {
-        glUniform1iv(uniformLocation, (GLsizei)values.size(), values.data());
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform1iv(uniformLocation, (GLsizei)values.size(), values.data());
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::ivec2> &values)
     {
-        glUniform2iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform2iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::ivec3> &values)
     {
-        glUniform3iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform3iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::ivec4> &values)
     {
-        glUniform4iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniform4iv(uniformLocation, (GLsizei)values.size(), glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::mat2> &values)
     {
-        glUniformMatrix2fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniformMatrix2fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::mat3> &values)
     {
-        glUniformMatrix3fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniformMatrix3fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        }
     }
 
     void setUniform(int32_t uniformLocation, const std::vector<glm::mat4> &values)
     {
-        glUniformMatrix4fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        if (uniformChanged(uniformLocation, values.data(), sizeof(values.front()) * values.size()))
+        {
+            glUniformMatrix4fv(uniformLocation, (GLsizei)values.size(), GL_FALSE, glm::value_ptr(values.front()));
+        }
     }
 };
 
@@ -0,0 +1,186 @@
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <cassert>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "IndexBuffer.h"
+#include "RenderStats.h"
+#include "ShaderProgram.h"
+#include "Texture.h"
+#include "TextureArray.h"
+#include "VertexBuffer.h"
+
+// texCoord.p is the TextureArray layer, ignored with plain textures.
+// texCoord.q is added to the clip space depth, on top of u_depthLayer.
+struct SpriteVertex
+{
+    glm::vec3 position;
+    glm::vec4 texCoord;
+};
+
+// Accumulates transformed quads into a single streaming vertex buffer and
+// only issues a draw call when the program or texture changes, or when the
+// batch is full. The depth layer goes into every vertex, so sprites on
+// different layers still share a draw. Sprites drawn from the layers of one
+// TextureArray do not break the batch. Quads are drawn with the shared quad index
+// buffer, 4 vertices each. Vertices go through a ring buffer sized for
+// several full batches per frame, so flushing never reallocates storage.
+struct SpriteBatch
+{
+    VertexBuffer *vbo = NULL;
+    std::vector<SpriteVertex> vertices;
+    size_t maxSprites = 0;
+
+    ShaderProgram *program = NULL;
+    GLint u_model = -1;
+    GLint u_depthLayer = -1;
+    Texture *texture = NULL;
+    TextureArray *textureArray = NULL;
+    float depthLayer = 0.0f;
+
+    SpriteBatch(size_t maxSprites = 4096, int batchesPerFrame = 8) : maxSprites(maxSprites)
+    {
+        vbo = new VertexBuffer();
+        vbo->allocateRing(sizeof(SpriteVertex) * maxSprites * 4 * batchesPerFrame);
+        vertices.reserve(maxSprites * 4);
+    }
+
+    ~SpriteBatch()
+    {
+        delete vbo;
+        vbo = NULL;
+    }
+
+    // The projection comes from the PerView block. Sprites are already in
+    // world space so the model matrix is identity.
+    void setProgram(ShaderProgram *newProgram, GLint modelLocation, GLint depthLayerLocation)
+    {
+        if (newProgram != program || modelLocation != u_model || depthLayerLocation != u_depthLayer)
+        {
+            flush();
+            program = newProgram;
+            u_model = modelLocation;
+            u_depthLayer = depthLayerLocation;
+        }
+    }
+
+    // Applies to the sprites drawn next, doesn't flush
+    void setDepthLayer(float newDepthLayer)
+    {
+        depthLayer = newDepthLayer;
+    }
+
+    // quad is 4 vertices in GL_TRIANGLE_STRIP order. The vertices are
+    // transformed by model on the CPU so sprites with different model
+    // matrices can share the same draw call.
+    template<typename Vertex>
+    void draw(Texture *newTexture, const std::vector<Vertex> &quad, const glm::mat4 &model)
+    {
+        if (newTexture != texture || textureArray)
+        {
+            flush();
+            texture = newTexture;
+            textureArray = NULL;
+        }
+
+        append(quad, model, glm::vec2(1.0f), 0);
+    }
+
+    // Same as above, sampling one layer of a texture array. The program must
+    // be built with TEXTURE_ARRAY defined.
+    template<typename Vertex>
+    void draw(TextureArray *newTextureArray, int layer, const std::vector<Vertex> &quad, const glm::mat4 &model)
+    {
+        if (newTextureArray != textureArray || texture)
+        {
+            flush();
+            textureArray = newTextureArray;
+            texture = NULL;
+        }
+
+        append(quad, model, newTextureArray->texCoordScale(layer), layer);
+    }
+
+    template<typename Vertex>
+    void append(const std::vector<Vertex> &quad, const glm::mat4 &model, const glm::vec2 &texCoordScale, int layer)
+    {
+        assert(quad.size() == 4);
+
+        if (vertices.size() + 4 > maxSprites * 4)
+        {
+            flush();
+        }
+
+        for(size_t i = 0; i < 4; ++i)
+        {
+            SpriteVertex v;
+            v.position = glm::vec3(model * glm::vec4(quad[i].position, 1.0f));
+            v.texCoord = glm::vec4(glm::vec2(quad[i].texCoord) * texCoordScale, (float)layer, depthLayer);
+            vertices.push_back(v);
+        }
+
+        RenderStats::frame().spritesDrawn++;
+    }
+
+    void flush()
+    {
+        if (vertices.empty())
+        {
+            return;
+        }
+
+        assert(program && (texture || textureArray));
+
+        GLsizei quadCount = (GLsizei)(vertices.size() / 4);
+        IndexBuffer *indices = IndexBuffer::quads(quadCount);
+
+        program->bind();
+        program->setUniform(u_model, glm::identity<glm::mat4>());
+        program->setUniform(u_depthLayer, 0.0f); // Carried by the vertices
+        GLint first = vbo->stream(vertices);
+        if (textureArray)
+        {
+            textureArray->bind();
+        }
+        else
+        {
+            texture->bind();
+        }
+
+        if (glDrawElementsBaseVertex)
+        {
+            vbo->bind(program);
+            indices->bind(); // after the VAO, the element array binding is part of it
+            glDrawElementsBaseVertex(GL_TRIANGLES, quadCount * 6, indices->type, indices->offsetOf(0), first);
+        }
+        else
+        {
+            // No base vertex on GLES 3.1 and older, point the attributes at the first vertex instead.
+            vbo->bind(program, first * sizeof(SpriteVertex));
+            indices->bind();
+            glDrawElements(GL_TRIANGLES, quadCount * 6, indices->type, indices->offsetOf(0));
+        }
+
+        RenderStats::frame().drawCalls++;
+        RenderStats::frame().batchFlushes++;
+
+        vertices.clear();
+    }
+
+    // Drop the current state so the next frame starts from scratch.
+    void end()
+    {
+        flush();
+        vbo->nextFrame();
+        program = NULL;
+        texture = NULL;
+        textureArray = NULL;
+    }
+};
+
+#endif // SPRITEBATCH_H
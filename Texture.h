@@ -1,17 +1,53 @@
 #ifndef TEXTURE_H
 #define TEXTURE_H
 
+#include <algorithm>
 #include <string>
 
 #include <glad/glad.h>
+#include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 
+#include "CompressedFormat.h"
+#include "GLState.h"
+#include "KtxImage.h"
+#include "PixelConvert.h"
+
 struct Texture
 {
+    // Pending textures have no image yet (still decoding, or never
+    // decoded) and draw with a placeholder instead.
+    enum State
+    {
+        Pending,
+        Ready,
+        Failed
+    };
+
+    // Minification filter. The mipmapped ones build the mip chain the
+    // first time they are applied.
+    enum Filter
+    {
+        Linear,     // base level only, aliases when minified
+        Bilinear,   // nearest mip level
+        Trilinear   // blend of the two nearest mip levels
+    };
+
     GLuint handle = 0;
     std::string filePath;
     int width = 0;
     int height = 0;
+    State state = Pending;
+    Filter filter = Linear;
+    float anisotropy = 1.0f;
+    bool hasMipmaps = false;
+    bool premultiplied = false; // color already multiplied by alpha
+    int levels = 1;
+    const CompressedFormat *compressedFormat = NULL; // NULL for RGBA8
+
+    // RGBA copy of the image, kept after upload when the load asked for it
+    // so it can be packed into arrays or atlases without decoding again.
+    SDL_Surface *pixels = NULL;
 
     Texture(const std::string &filePath) : filePath(filePath)
     {
@@ -20,56 +56,293 @@ struct Texture
 
     ~Texture()
     {
+        releasePixels();
+        GLState::current().forgetTexture(handle);
         glDeleteTextures(1, &handle);
         handle = 0;
     }
 
-    int decode()
+    bool isReady() const
+    {
+        return state == Ready;
+    }
+
+    // Loads filePath as tightly packed RGBA bytes. Does not touch GL, so
+    // it can run on any thread. Returns NULL on failure.
+    static SDL_Surface *decodeSurface(const std::string &filePath)
+    {
+        SDL_Surface* surface = loadSurface(filePath);
+        if (surface == NULL || surface->format->format == SDL_PIXELFORMAT_RGBA32)
+        {
+            return surface;
+        }
+        return convertSurface(surface, filePath);
+    }
+
+    // Like decodeSurface(), but keeps the format IMG_Load returned when
+    // PixelConvert can expand it to RGBA while copying to upload memory,
+    // which saves converting to a second surface first.
+    static SDL_Surface *loadSurface(const std::string &filePath)
     {
         SDL_Surface* surface = IMG_Load(filePath.c_str());
         if(surface == NULL)
         {
             SDL_LogCritical(0, "Unable to load image %s: %s", filePath.c_str(), IMG_GetError());
-            return -1;
+            return NULL;
         }
 
-        SDL_Surface *surfaceRGBA = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+        PixelConvert::Layout layout;
+        if (PixelConvert::layout(surface->format->format, layout))
+        {
+            return surface;
+        }
+        return convertSurface(surface, filePath);
+    }
+
+    // Frees surface
+    static SDL_Surface *convertSurface(SDL_Surface *surface, const std::string &filePath)
+    {
+        SDL_Surface *surfaceRGBA = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_RGBA32, 0);
+        SDL_FreeSurface(surface);
         if (surfaceRGBA == NULL)
         {
             SDL_LogCritical(0, "Unable to load convert %s to RGBA: %s", filePath.c_str(), SDL_GetError());
-            SDL_FreeSurface(surface);
+            return NULL;
+        }
+
+        return surfaceRGBA;
+    }
+
+    // keepPixels leaves the decoded image in pixels
+    int decode(bool keepPixels = false)
+    {
+        SDL_Surface *surfaceRGBA = decodeSurface(filePath);
+        if (surfaceRGBA == NULL)
+        {
+            state = Failed;
             return -1;
         }
 
-        width = surfaceRGBA->w;
-        height = surfaceRGBA->h;
+        upload(surfaceRGBA->pixels, surfaceRGBA->w, surfaceRGBA->h);
 
-        bind(0);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, surfaceRGBA->w, surfaceRGBA->h, 0, GL_RGBA, GL_UNSIGNED_BYTE, surfaceRGBA->pixels);
+        if (keepPixels)
+        {
+            releasePixels();
+            pixels = surfaceRGBA;
+        }
+        else
+        {
+            SDL_FreeSurface(surfaceRGBA);
+        }
+
+        return 0;
+    }
+
+    void releasePixels()
+    {
+        SDL_FreeSurface(pixels);
+        pixels = NULL;
+    }
+
+    // pixels are RGBA bytes, or an offset when a pixel unpack buffer is bound.
+    void upload(const void *pixels, int imageWidth, int imageHeight)
+    {
+        width = imageWidth;
+        height = imageHeight;
+
+        // Not bind(), which would select the placeholder while Pending
+        GLState::current().bindTexture(GL_TEXTURE_2D, 0, handle);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+
+        compressedFormat = NULL;
+        premultiplied = false;
+        setLevels(1);
+    }
+
+    // Uploads the whole mip chain of image, compressed when it still is.
+    void upload(const KtxImage &image)
+    {
+        width = image.width();
+        height = image.height();
+        compressedFormat = image.format;
+        premultiplied = false;
+
+        GLState::current().bindTexture(GL_TEXTURE_2D, 0, handle);
+        for(size_t level = 0; level < image.levels.size(); ++level)
+        {
+            const KtxImage::Level &l = image.levels[level];
+            if (compressedFormat)
+            {
+                glCompressedTexImage2D(GL_TEXTURE_2D, (GLint)level, compressedFormat->glFormat, l.width, l.height, 0, (GLsizei)l.size, image.levelData((int)level));
+            }
+            else
+            {
+                glTexImage2D(GL_TEXTURE_2D, (GLint)level, GL_RGBA, l.width, l.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, image.levelData((int)level));
+            }
+        }
+
+        setLevels((int)image.levels.size());
+    }
+
+    // Common to every upload, with the texture bound. A chain shorter than
+    // the full one needs GL_TEXTURE_MAX_LEVEL (GL 3.0 / GLES 3.0), otherwise
+    // the texture is incomplete.
+    void setLevels(int levelCount)
+    {
+        levels = levelCount;
+        hasMipmaps = levels > 1;
+        if (GLAD_GL_VERSION_3_0 || GLAD_GL_ES_VERSION_3_0)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, hasMipmaps ? levels - 1 : 1000);
+        }
 
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 
-        SDL_FreeSurface(surfaceRGBA);
-        SDL_FreeSurface(surface);
+        state = Ready;
+        applySampling();
+    }
 
-        return 0;
+    // Takes effect immediately when Ready, otherwise once uploaded.
+    void setSampling(Filter newFilter, float newAnisotropy)
+    {
+        filter = newFilter;
+        anisotropy = newAnisotropy;
+        if (state == Ready)
+        {
+            applySampling();
+        }
+    }
+
+    void applySampling()
+    {
+        bind(0);
+
+        // Compressed chains come from the file, GL can't generate them
+        if (filter != Linear && !hasMipmaps && !compressedFormat && canMipmap(width, height))
+        {
+            glGenerateMipmap(GL_TEXTURE_2D);
+            hasMipmaps = true;
+            for(int size = std::max(width, height); size > 1; size /= 2)
+            {
+                levels++;
+            }
+        }
+
+        GLint minFilter = GL_LINEAR;
+        if (hasMipmaps && filter == Bilinear)
+        {
+            minFilter = GL_LINEAR_MIPMAP_NEAREST;
+        }
+        else if (hasMipmaps && filter == Trilinear)
+        {
+            minFilter = GL_LINEAR_MIPMAP_LINEAR;
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, minFilter);
+
+        float maxAnisotropy = Texture::maxAnisotropy();
+        if (maxAnisotropy > 1.0f)
+        {
+            glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAX_ANISOTROPY, std::max(1.0f, std::min(anisotropy, maxAnisotropy)));
+        }
+    }
+
+    // GLES 2 / WebGL 1 only mipmap power of two textures
+    static bool canMipmap(int w, int h)
+    {
+        bool powerOfTwo = w > 0 && h > 0 && (w & (w - 1)) == 0 && (h & (h - 1)) == 0;
+        return glGenerateMipmap != NULL && (GLAD_GL_VERSION_3_0 || GLAD_GL_ES_VERSION_3_0 || powerOfTwo);
+    }
+
+    // Core in GL 4.6, otherwise GL_EXT/ARB_texture_filter_anisotropic.
+    // Returns 1 when anisotropic filtering is unavailable.
+    static float maxAnisotropy()
+    {
+        static float value = 0.0f;
+        if (value == 0.0f)
+        {
+            value = 1.0f;
+            if (GLAD_GL_VERSION_4_6 ||
+                SDL_GL_ExtensionSupported("GL_EXT_texture_filter_anisotropic") ||
+                SDL_GL_ExtensionSupported("GL_ARB_texture_filter_anisotropic"))
+            {
+                glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &value);
+            }
+        }
+        return value;
+    }
+
+    int levelCount() const
+    {
+        return levels;
+    }
+
+    const char *formatName() const
+    {
+        return compressedFormat ? compressedFormat->name : "RGBA8";
+    }
+
+    size_t levelByteCount(int level) const
+    {
+        int w = std::max(width >> level, 1);
+        int h = std::max(height >> level, 1);
+        return compressedFormat ? CompressedFormat::levelByteCount(compressedFormat->blockBytes, w, h) : (size_t)w * h * 4;
+    }
+
+    // GPU memory used by the base level plus the mip chain
+    size_t byteCount() const
+    {
+        size_t bytes = 0;
+        for(int level = 0; level < levelCount(); ++level)
+        {
+            bytes += levelByteCount(level);
+        }
+        return bytes;
     }
 
     void bind(GLuint textureSlot = 0)
     {
-        glActiveTexture(GL_TEXTURE0 + textureSlot);
-        glBindTexture(GL_TEXTURE_2D, handle);
+        GLState::current().bindTexture(GL_TEXTURE_2D, textureSlot, state == Ready ? handle : placeholder());
     }
 
     void unbind(GLuint textureSlot = 0)
     {
-        glActiveTexture(GL_TEXTURE0 + textureSlot);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        GLState::current().bindTexture(GL_TEXTURE_2D, textureSlot, 0);
+    }
+
+    // 1x1 grey texture drawn in place of pending textures. Created on first use.
+    static GLuint &placeholderHandle()
+    {
+        static GLuint handle = 0;
+        return handle;
     }
 
+    static GLuint placeholder()
+    {
+        GLuint &handle = placeholderHandle();
+        if (!handle)
+        {
+            static const unsigned char grey[4] = { 128, 128, 128, 255 };
+            glGenTextures(1, &handle);
+            GLState::current().bindTexture(GL_TEXTURE_2D, 0, handle);
+            glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        }
+        return handle;
+    }
+
+    static void releasePlaceholder()
+    {
+        GLuint &handle = placeholderHandle();
+        if (handle)
+        {
+            GLState::current().forgetTexture(handle);
+            glDeleteTextures(1, &handle);
+            handle = 0;
+        }
+    }
 };
 
 #endif // TEXTURE_H
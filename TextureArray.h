@@ -0,0 +1,127 @@
+#ifndef TEXTUREARRAY_H
+#define TEXTUREARRAY_H
+
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <SDL2/SDL_image.h>
+
+#include "GLState.h"
+
+// GL_TEXTURE_2D_ARRAY holding several images, one per layer, so sprites
+// using different images can share a draw call. Every layer has the same
+// size: images smaller than a layer sit in its top left corner and their
+// texture coordinates are scaled by texCoordScale(layer). The last row and
+// column of each image are repeated once so linear filtering does not bleed
+// the unused part of the layer into the edges.
+//
+// Requires GL 3.0 or GLES 3.0.
+struct TextureArray
+{
+    GLuint handle = 0;
+    int width = 0;
+    int height = 0;
+    int layerCount = 0;
+    std::vector<glm::vec2> texCoordScales;
+
+    TextureArray(int width, int height, int layerCount) : width(width), height(height), layerCount(layerCount)
+    {
+        glGenTextures(1, &handle);
+
+        bind(0);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, width, height, layerCount, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    }
+
+    ~TextureArray()
+    {
+        GLState::current().forgetTexture(handle);
+        glDeleteTextures(1, &handle);
+        handle = 0;
+    }
+
+    static bool supported()
+    {
+        return glTexImage3D != NULL && (GLAD_GL_VERSION_3_0 || GLAD_GL_ES_VERSION_3_0);
+    }
+
+    // Decodes filePath into the next free layer. Returns the layer, or -1.
+    int add(const std::string &filePath)
+    {
+        SDL_Surface* surface = IMG_Load(filePath.c_str());
+        if(surface == NULL)
+        {
+            SDL_LogCritical(0, "Unable to load image %s: %s", filePath.c_str(), IMG_GetError());
+            return -1;
+        }
+
+        SDL_Surface *surfaceRGBA = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ABGR8888, 0);
+        SDL_FreeSurface(surface);
+        if (surfaceRGBA == NULL)
+        {
+            SDL_LogCritical(0, "Unable to load convert %s to RGBA: %s", filePath.c_str(), SDL_GetError());
+            return -1;
+        }
+
+        int layer = add((const unsigned char *)surfaceRGBA->pixels, surfaceRGBA->w, surfaceRGBA->h, surfaceRGBA->pitch);
+        if (layer < 0)
+        {
+            SDL_LogCritical(0, "No room for %s (%dx%d) in %d %dx%d layers", filePath.c_str(), surfaceRGBA->w, surfaceRGBA->h, layerCount, width, height);
+        }
+
+        SDL_FreeSurface(surfaceRGBA);
+
+        return layer;
+    }
+
+    // Copies RGBA pixels, pitch bytes per row, into the next free layer.
+    // Returns the layer, or -1 when none is left or the image is too large.
+    int add(const unsigned char *pixels, int w, int h, int pitch)
+    {
+        int layer = (int)texCoordScales.size();
+        if (layer >= layerCount || w > width || h > height)
+        {
+            return -1;
+        }
+
+        bind(0);
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, pitch / 4);
+        glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, w, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+        if (w < width)
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, w, 0, layer, 1, h, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels + (w - 1) * 4);
+        }
+        if (h < height)
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, h, layer, w, 1, 1, GL_RGBA, GL_UNSIGNED_BYTE, pixels + (h - 1) * pitch);
+        }
+        glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+
+        texCoordScales.push_back(glm::vec2((float)w / width, (float)h / height));
+
+        return layer;
+    }
+
+    glm::vec2 texCoordScale(int layer) const
+    {
+        return texCoordScales[layer];
+    }
+
+    void bind(GLuint textureSlot = 0)
+    {
+        GLState::current().bindTexture(GL_TEXTURE_2D_ARRAY, textureSlot, handle);
+    }
+
+    void unbind(GLuint textureSlot = 0)
+    {
+        GLState::current().bindTexture(GL_TEXTURE_2D_ARRAY, textureSlot, 0);
+    }
+};
+
+#endif // TEXTUREARRAY_H
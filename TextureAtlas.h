@@ -0,0 +1,200 @@
+#ifndef TEXTUREATLAS_H
+#define TEXTUREATLAS_H
+
+#include <algorithm>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <SDL2/SDL.h>
+
+#include "GLState.h"
+#include "Texture.h"
+
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include "imstb_rectpack.h"
+
+// Packs images into shared pages so sprites using different images can be
+// drawn with the same texture, and batch together. Pages are plain 2D
+// textures, unlike TextureArray they work on GLES 2 / WebGL 1 and images
+// of any size share them without wasting a whole layer.
+//
+// Images are added one at a time: each goes to the first page with room
+// left, a new page is allocated when none has. The skyline packer keeps
+// its state between insertions, but sorting a known set of images by
+// height before adding them still packs tighter.
+//
+// Every image is surrounded by Padding texels repeating its edges, so
+// linear filtering never reads a neighbour. Pages have no mipmaps, lower
+// levels would blend neighbours regardless of padding.
+struct TextureAtlas
+{
+    static const int Padding = 1;
+
+    struct Page
+    {
+        Texture *texture;
+        stbrp_context context;
+        std::vector<stbrp_node> nodes;
+        size_t usedTexels;
+    };
+
+    // Where an image landed, texture coordinates map [0, 1] into it
+    struct Region
+    {
+        int page;
+        int x;
+        int y;
+        int width;
+        int height;
+        glm::vec2 texCoordOffset;
+        glm::vec2 texCoordScale;
+    };
+
+    int pageWidth = 0;
+    int pageHeight = 0;
+    std::vector<Page*> pages;
+    std::vector<Region> regions;
+
+    // Pages are clamped to GL_MAX_TEXTURE_SIZE
+    TextureAtlas(int width = 2048, int height = 2048)
+    {
+        GLint maxSize = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+        pageWidth = maxSize > 0 ? std::min(width, (int)maxSize) : width;
+        pageHeight = maxSize > 0 ? std::min(height, (int)maxSize) : height;
+    }
+
+    ~TextureAtlas()
+    {
+        for(size_t i = 0; i < pages.size(); ++i)
+        {
+            delete pages[i]->texture;
+            delete pages[i];
+        }
+    }
+
+    // Decodes filePath into the atlas. Returns the region, or -1.
+    int add(const std::string &filePath)
+    {
+        SDL_Surface *surface = Texture::decodeSurface(filePath);
+        if (surface == NULL)
+        {
+            return -1;
+        }
+
+        int region = add((const unsigned char *)surface->pixels, surface->w, surface->h, surface->pitch);
+        if (region < 0)
+        {
+            SDL_LogCritical(0, "No room for %s (%dx%d) in %dx%d atlas pages", filePath.c_str(), surface->w, surface->h, pageWidth, pageHeight);
+        }
+
+        SDL_FreeSurface(surface);
+        return region;
+    }
+
+    // Packs RGBA pixels, pitch bytes per row. Returns the region, or -1
+    // when the image doesn't fit in an empty page.
+    int add(const unsigned char *pixels, int width, int height, int pitch)
+    {
+        stbrp_rect rect = {};
+        rect.w = width + 2 * Padding;
+        rect.h = height + 2 * Padding;
+        if (rect.w > pageWidth || rect.h > pageHeight)
+        {
+            return -1;
+        }
+
+        int page = 0;
+        for(; page < (int)pages.size(); ++page)
+        {
+            if (stbrp_pack_rects(&pages[page]->context, &rect, 1) && rect.was_packed)
+            {
+                break;
+            }
+        }
+        if (page == (int)pages.size())
+        {
+            addPage();
+            stbrp_pack_rects(&pages[page]->context, &rect, 1);
+        }
+
+        Region region;
+        region.page = page;
+        region.x = rect.x + Padding;
+        region.y = rect.y + Padding;
+        region.width = width;
+        region.height = height;
+        region.texCoordOffset = glm::vec2((float)region.x / pageWidth, (float)region.y / pageHeight);
+        region.texCoordScale = glm::vec2((float)width / pageWidth, (float)height / pageHeight);
+        regions.push_back(region);
+
+        // Copy with the edges repeated into the padding, one upload per image
+        std::vector<unsigned char> padded((size_t)rect.w * rect.h * 4);
+        for(int y = 0; y < rect.h; ++y)
+        {
+            int srcY = std::min(std::max(y - Padding, 0), height - 1);
+            for(int x = 0; x < rect.w; ++x)
+            {
+                int srcX = std::min(std::max(x - Padding, 0), width - 1);
+                memcpy(&padded[((size_t)y * rect.w + x) * 4], pixels + (size_t)srcY * pitch + srcX * 4, 4);
+            }
+        }
+
+        pages[page]->texture->bind(0);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, rect.x, rect.y, rect.w, rect.h, GL_RGBA, GL_UNSIGNED_BYTE, padded.data());
+        pages[page]->usedTexels += (size_t)width * height;
+
+        return (int)regions.size() - 1;
+    }
+
+    void addPage()
+    {
+        Page *page = new Page();
+        page->texture = new Texture("atlas page " + std::to_string(pages.size()));
+        page->texture->upload(NULL, pageWidth, pageHeight);
+        page->nodes.resize(pageWidth);
+        page->usedTexels = 0;
+        stbrp_init_target(&page->context, pageWidth, pageHeight, page->nodes.data(), (int)page->nodes.size());
+        pages.push_back(page);
+    }
+
+    Texture *texture(int region) const
+    {
+        return pages[regions[region].page]->texture;
+    }
+
+    // Maps texture coordinates of a quad drawn with the standalone image
+    // into the region. Apply once, on a copy of the vertices.
+    template<typename Vertex>
+    void rewriteTexCoords(int region, std::vector<Vertex> &vertices) const
+    {
+        const Region &r = regions[region];
+        for(size_t i = 0; i < vertices.size(); ++i)
+        {
+            vertices[i].texCoord.x = r.texCoordOffset.x + vertices[i].texCoord.x * r.texCoordScale.x;
+            vertices[i].texCoord.y = r.texCoordOffset.y + vertices[i].texCoord.y * r.texCoordScale.y;
+        }
+    }
+
+    // Image texels over allocated page texels, padding counts as waste
+    float efficiency() const
+    {
+        size_t used = 0;
+        for(size_t i = 0; i < pages.size(); ++i)
+        {
+            used += pages[i]->usedTexels;
+        }
+        return pages.empty() ? 0.0f : (float)used / ((float)pageWidth * pageHeight * pages.size());
+    }
+
+    size_t byteCount() const
+    {
+        return (size_t)pageWidth * pageHeight * 4 * pages.size();
+    }
+};
+
+#endif // TEXTUREATLAS_H
@@ -0,0 +1,274 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <SDL2/SDL.h>
+
+#include "KtxImage.h"
+#include "Texture.h"
+#include "TextureLoader.h"
+
+// Shares one Texture between every user of the same image. Lookups go by
+// normalized path first, then by content, so the same image under two
+// names is decoded and stored once. Content is only compared when a
+// resident texture's file has the same size, so a miss usually costs one
+// size query instead of a file read on the calling thread.
+//
+// Every acquire() must be paired with a release(). The texture, and its GPU
+// memory, goes away with the last release, or once its load completes if
+// it's still Pending in the loader by then.
+struct TextureCache
+{
+    struct Entry
+    {
+        Texture *texture;
+        std::string key;
+        size_t fileSize; // 0 when unreadable
+        bool decompress;
+        int references;
+    };
+
+    TextureLoader *loader = NULL;
+    std::map<std::string, Entry*> byPath;
+    std::multimap<size_t, Entry*> bySize;
+    std::map<Texture*, Entry*> byTexture;
+    std::vector<Texture*> released;
+
+    // Statistics
+    int pathHits = 0;
+    int contentHits = 0;
+    int misses = 0;
+
+    // Textures are decoded by loader when given, synchronously otherwise.
+    TextureCache(TextureLoader *loader = NULL) : loader(loader)
+    {
+    }
+
+    // Deletes every texture, acquired or not. The loader must be gone first.
+    ~TextureCache()
+    {
+        for(std::map<Texture*, Entry*>::iterator it = byTexture.begin(); it != byTexture.end(); ++it)
+        {
+            delete it->first;
+            delete it->second;
+        }
+        for(size_t i = 0; i < released.size(); ++i)
+        {
+            delete released[i];
+        }
+    }
+
+    // decompress forces the CPU decoder for KTX files, and makes a
+    // different texture than the compressed one. keepPixels is passed to
+    // TextureLoader::load() and only applies when this call loads the
+    // texture, acquire images to pack before anything else shares them.
+    Texture *acquire(const std::string &filePath, bool decompress = false, bool keepPixels = false)
+    {
+        std::string key = normalizePath(filePath) + (decompress ? "#decompressed" : "");
+        std::map<std::string, Entry*>::iterator path = byPath.find(key);
+        if (path != byPath.end())
+        {
+            pathHits++;
+            path->second->references++;
+            return path->second->texture;
+        }
+
+        // Unreadable files still get an entry, the texture ends up Failed
+        size_t size = fileSize(filePath);
+        Entry *same = size ? findContent(filePath, size, decompress) : NULL;
+        if (same)
+        {
+            contentHits++;
+            byPath[key] = same;
+            same->references++;
+            return same->texture;
+        }
+
+        misses++;
+        Entry *entry = new Entry();
+        entry->texture = new Texture(filePath);
+        entry->key = key;
+        entry->fileSize = size;
+        entry->decompress = decompress;
+        entry->references = 1;
+        byPath[key] = entry;
+        if (size)
+        {
+            bySize.insert(std::make_pair(size, entry));
+        }
+        byTexture[entry->texture] = entry;
+
+        if (loader)
+        {
+            loader->load(entry->texture, decompress, keepPixels);
+        }
+        else
+        {
+            entry->texture->decode(keepPixels);
+        }
+        return entry->texture;
+    }
+
+    void release(Texture *texture)
+    {
+        std::map<Texture*, Entry*>::iterator it = byTexture.find(texture);
+        if (it == byTexture.end())
+        {
+            SDL_LogWarn(0, "Releasing a texture the cache doesn't own");
+            return;
+        }
+
+        Entry *entry = it->second;
+        if (--entry->references > 0)
+        {
+            return;
+        }
+
+        // Every path aliasing this content goes with it
+        for(std::map<std::string, Entry*>::iterator path = byPath.begin(); path != byPath.end();)
+        {
+            if (path->second == entry)
+            {
+                byPath.erase(path++);
+            }
+            else
+            {
+                ++path;
+            }
+        }
+        std::pair<std::multimap<size_t, Entry*>::iterator, std::multimap<size_t, Entry*>::iterator> sized = bySize.equal_range(entry->fileSize);
+        for(std::multimap<size_t, Entry*>::iterator same = sized.first; same != sized.second; ++same)
+        {
+            if (same->second == entry)
+            {
+                bySize.erase(same);
+                break;
+            }
+        }
+        byTexture.erase(it);
+
+        released.push_back(entry->texture);
+        delete entry;
+        collect();
+    }
+
+    // Deletes released textures the loader is done with. Call once per
+    // frame, after TextureLoader::poll().
+    void collect()
+    {
+        for(size_t i = 0; i < released.size();)
+        {
+            if (released[i]->state != Texture::Pending)
+            {
+                delete released[i];
+                released[i] = released.back();
+                released.pop_back();
+            }
+            else
+            {
+                ++i;
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return byTexture.size();
+    }
+
+    size_t byteCount() const
+    {
+        size_t bytes = 0;
+        for(std::map<Texture*, Entry*>::const_iterator it = byTexture.begin(); it != byTexture.end(); ++it)
+        {
+            if (it->first->isReady())
+            {
+                bytes += it->first->byteCount();
+            }
+        }
+        return bytes;
+    }
+
+    // Forward slashes, no empty, "." or resolvable ".." components:
+    // "assets//./sprites/../mike.png" and "assets/mike.png" are one key.
+    static std::string normalizePath(const std::string &filePath)
+    {
+        std::vector<std::string> parts;
+        std::string part;
+        for(size_t i = 0; i <= filePath.size(); ++i)
+        {
+            char c = i < filePath.size() ? filePath[i] : '/';
+            if (c != '/' && c != '\\')
+            {
+                part += c;
+                continue;
+            }
+
+            if (part == ".." && !parts.empty() && parts.back() != "..")
+            {
+                parts.pop_back();
+            }
+            else if (!part.empty() && part != ".")
+            {
+                parts.push_back(part);
+            }
+            part.clear();
+        }
+
+        std::string normalized = !filePath.empty() && (filePath[0] == '/' || filePath[0] == '\\') ? "/" : "";
+        for(size_t i = 0; i < parts.size(); ++i)
+        {
+            normalized += (i ? "/" : "") + parts[i];
+        }
+        return normalized;
+    }
+
+    // Resident entry whose file has the same bytes as filePath. Both files
+    // are read only when their sizes match.
+    Entry *findContent(const std::string &filePath, size_t size, bool decompress)
+    {
+        std::pair<std::multimap<size_t, Entry*>::iterator, std::multimap<size_t, Entry*>::iterator> sized = bySize.equal_range(size);
+        std::vector<uint8_t> content;
+        for(std::multimap<size_t, Entry*>::iterator it = sized.first; it != sized.second; ++it)
+        {
+            Entry *entry = it->second;
+            if (entry->decompress != decompress)
+            {
+                continue;
+            }
+
+            std::vector<uint8_t> other;
+            if ((content.empty() && KtxImage::readFile(filePath, content) != 0) ||
+                KtxImage::readFile(entry->texture->filePath, other) != 0)
+            {
+                continue;
+            }
+            if (other == content)
+            {
+                return entry;
+            }
+        }
+        return NULL;
+    }
+
+    // 0 when the file can't be opened or is empty
+    static size_t fileSize(const std::string &filePath)
+    {
+        SDL_RWops *rw = SDL_RWFromFile(filePath.c_str(), "rb");
+        if (rw == NULL)
+        {
+            return 0;
+        }
+
+        Sint64 size = SDL_RWsize(rw);
+        SDL_RWclose(rw);
+        return size > 0 ? (size_t)size : 0;
+    }
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,361 @@
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <string>
+#include <vector>
+
+#ifndef __EMSCRIPTEN__
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+#include <glad/glad.h>
+#include <SDL2/SDL.h>
+
+#include "GLState.h"
+#include "KtxImage.h"
+#include "PixelConvert.h"
+#include "Texture.h"
+
+// Decodes images on a pool of worker threads so startup doesn't wait for
+// every IMG_Load. Decoded surfaces come back through a lock-free stack and
+// poll() uploads them on the GL thread, through a pixel unpack buffer when
+// available (GL 2.1 / GLES 3.0) so glTexImage2D sources GPU memory instead
+// of blocking on a client-side copy.
+//
+// Surfaces stay in the format IMG_Load produced: PixelConvert expands them
+// to RGBA, and premultiplies alpha if asked, while writing the mapped
+// buffer. SDL_image can't decode into caller memory, so that is one copy
+// of the image between the decoder and the driver.
+//
+// KTX files are read whole and uploaded compressed, or decompressed on the
+// worker when CompressedFormat::detect() found no support for their format.
+//
+// Textures stay Pending, drawing a placeholder, until uploaded. Emscripten
+// builds have no threads: poll() decodes one image per frame instead.
+struct TextureLoader
+{
+    // Uploads per poll() stop after this many bytes, so a burst of
+    // finished decodes doesn't turn into a long frame
+    static const size_t DefaultUploadBudget = 16 * 1024 * 1024;
+
+    struct Request
+    {
+        Texture *texture;
+        std::string filePath;
+        bool decompress;
+        bool keepPixels;
+    };
+
+    struct DecodedImage
+    {
+        Texture *texture;
+        SDL_Surface *surface;
+        KtxImage *ktx;
+        bool keepPixels;
+        DecodedImage *next;
+    };
+
+    GLuint pixelBuffer = 0;
+    int pendingCount = 0;
+
+    // Applies to images uploaded from then on. Opaque images are unaffected.
+    bool premultiplyAlpha = false;
+
+    // Consumed by the workers, or by poll() without threads
+    std::deque<Request> requests;
+
+    // Filled by the workers, emptied by poll()
+    std::atomic<DecodedImage*> decoded;
+
+    // Decoded but not uploaded yet because the budget ran out, oldest first
+    std::deque<DecodedImage*> ready;
+
+#ifndef __EMSCRIPTEN__
+    std::mutex requestMutex;
+    std::condition_variable requestAdded;
+    std::vector<std::thread> workers;
+    bool stopping = false;
+#endif
+
+    TextureLoader() : decoded(NULL)
+    {
+#ifndef __EMSCRIPTEN__
+        // Leave a core to the render thread
+        unsigned int threadCount = std::thread::hardware_concurrency();
+        threadCount = threadCount > 2 ? threadCount - 1 : 1;
+        for(unsigned int t = 0; t < threadCount; ++t)
+        {
+            workers.push_back(std::thread([this]() { work(); }));
+        }
+#endif
+    }
+
+    // Must be deleted while the context is still alive and before the
+    // textures it is loading.
+    ~TextureLoader()
+    {
+#ifndef __EMSCRIPTEN__
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            stopping = true;
+        }
+        requestAdded.notify_all();
+        for(size_t t = 0; t < workers.size(); ++t)
+        {
+            workers[t].join();
+        }
+#endif
+
+        takeDecoded();
+        for(size_t i = 0; i < ready.size(); ++i)
+        {
+            SDL_FreeSurface(ready[i]->surface);
+            delete ready[i]->ktx;
+            delete ready[i];
+        }
+
+        if (pixelBuffer)
+        {
+            GLState::current().forgetBuffer(pixelBuffer);
+            glDeleteBuffers(1, &pixelBuffer);
+        }
+    }
+
+    // Queues texture for decoding. It draws the placeholder until a later
+    // poll() uploads it. decompress forces the CPU decoder for KTX files.
+    // keepPixels leaves an RGBA copy in Texture::pixels, ignored for KTX.
+    void load(Texture *texture, bool decompress = false, bool keepPixels = false)
+    {
+        texture->state = Texture::Pending;
+        pendingCount++;
+
+        Request request = { texture, texture->filePath, decompress, keepPixels };
+#ifndef __EMSCRIPTEN__
+        {
+            std::lock_guard<std::mutex> lock(requestMutex);
+            requests.push_back(request);
+        }
+        requestAdded.notify_one();
+#else
+        requests.push_back(request);
+#endif
+    }
+
+    bool busy() const
+    {
+        return pendingCount > 0;
+    }
+
+    // Uploads finished decodes, up to uploadBudget bytes (at least one
+    // image). Call once per frame on the GL thread. Returns the number of
+    // textures that became Ready or Failed.
+    int poll(size_t uploadBudget = DefaultUploadBudget)
+    {
+        if (pendingCount == 0)
+        {
+            return 0;
+        }
+
+#ifdef __EMSCRIPTEN__
+        if (!requests.empty())
+        {
+            Request request = requests.front();
+            requests.pop_front();
+            decode(request);
+        }
+#endif
+
+        takeDecoded();
+
+        int completed = 0;
+        size_t uploaded = 0;
+        while(!ready.empty() && (completed == 0 || uploaded < uploadBudget))
+        {
+            DecodedImage *image = ready.front();
+            ready.pop_front();
+
+            if (image->surface)
+            {
+                uploaded += upload(image->texture, image->surface);
+                if (image->keepPixels)
+                {
+                    image->texture->releasePixels();
+                    image->texture->pixels = image->surface;
+                }
+                else
+                {
+                    SDL_FreeSurface(image->surface);
+                }
+            }
+            else if (image->ktx)
+            {
+                image->texture->upload(*image->ktx);
+                uploaded += image->ktx->data.size();
+                delete image->ktx;
+            }
+            else
+            {
+                image->texture->state = Texture::Failed;
+            }
+            delete image;
+
+            pendingCount--;
+            completed++;
+        }
+
+        return completed;
+    }
+
+    // Expands surface to tightly packed RGBA rows in dst
+    void convert(SDL_Surface *surface, unsigned char *dst)
+    {
+        PixelConvert::Layout layout;
+        PixelConvert::layout(surface->format->format, layout);
+
+        const unsigned char *src = (const unsigned char*)surface->pixels;
+        size_t rowSize = (size_t)surface->w * 4;
+        for(int y = 0; y < surface->h; ++y)
+        {
+            PixelConvert::convertRow(src + (size_t)y * surface->pitch, dst + y * rowSize, surface->w, layout, premultiplyAlpha);
+        }
+    }
+
+    size_t upload(Texture *texture, SDL_Surface *surface)
+    {
+        size_t rowSize = (size_t)surface->w * 4;
+        size_t size = rowSize * surface->h;
+
+        if (!(GLAD_GL_VERSION_2_1 || GLAD_GL_ES_VERSION_3_0) || glMapBufferRange == NULL)
+        {
+            uploadConverted(texture, surface);
+            texture->premultiplied = premultiplyAlpha;
+            return size;
+        }
+
+        if (!pixelBuffer)
+        {
+            glGenBuffers(1, &pixelBuffer);
+        }
+
+        // Orphan the previous storage, the driver may still be copying from it
+        GLState::current().bindBuffer(GL_PIXEL_UNPACK_BUFFER, pixelBuffer);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+
+        GLubyte *dst = (GLubyte*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (dst)
+        {
+            convert(surface, dst);
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+            texture->upload(NULL, surface->w, surface->h);
+        }
+        else
+        {
+            SDL_LogWarn(0, "Could not map a %ld bytes pixel buffer for %s", (long)size, texture->filePath.c_str());
+            GLState::current().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            uploadConverted(texture, surface);
+        }
+        texture->premultiplied = premultiplyAlpha;
+
+        GLState::current().bindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        return size;
+    }
+
+    // Without a pixel unpack buffer. RGBA surfaces that need no premultiply
+    // upload as they are, others through a temporary copy freed right after.
+    void uploadConverted(Texture *texture, SDL_Surface *surface)
+    {
+        if (surface->format->format == SDL_PIXELFORMAT_RGBA32 && surface->pitch == surface->w * 4 && !premultiplyAlpha)
+        {
+            texture->upload(surface->pixels, surface->w, surface->h);
+            return;
+        }
+
+        std::vector<unsigned char> converted((size_t)surface->w * 4 * surface->h);
+        convert(surface, converted.data());
+        texture->upload(converted.data(), surface->w, surface->h);
+    }
+
+    // Runs on a worker. Pushes a NULL image on failure.
+    void decode(const Request &request)
+    {
+        if (!KtxImage::isKtx(request.filePath))
+        {
+            // Kept pixels are converted to RGBA here, off the GL thread
+            SDL_Surface *surface = request.keepPixels ? Texture::decodeSurface(request.filePath) : Texture::loadSurface(request.filePath);
+            push(request.texture, surface, NULL, request.keepPixels);
+            return;
+        }
+
+        KtxImage *ktx = new KtxImage();
+        if (ktx->load(request.filePath) != 0 || ((request.decompress || !ktx->format->available) && ktx->decompress() != 0))
+        {
+            delete ktx;
+            ktx = NULL;
+        }
+        push(request.texture, NULL, ktx, false);
+    }
+
+    // Lock-free push, safe from any thread
+    void push(Texture *texture, SDL_Surface *surface, KtxImage *ktx, bool keepPixels)
+    {
+        DecodedImage *image = new DecodedImage();
+        image->texture = texture;
+        image->surface = surface;
+        image->ktx = ktx;
+        image->keepPixels = keepPixels;
+        image->next = decoded.load(std::memory_order_relaxed);
+        while(!decoded.compare_exchange_weak(image->next, image, std::memory_order_release, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    // Moves everything pushed so far to ready. The stack is newest first,
+    // so reverse it to upload in completion order.
+    void takeDecoded()
+    {
+        DecodedImage *head = decoded.exchange(NULL, std::memory_order_acquire);
+        DecodedImage *reversed = NULL;
+        while(head)
+        {
+            DecodedImage *next = head->next;
+            head->next = reversed;
+            reversed = head;
+            head = next;
+        }
+        for(; reversed; reversed = reversed->next)
+        {
+            ready.push_back(reversed);
+        }
+    }
+
+#ifndef __EMSCRIPTEN__
+    void work()
+    {
+        for(;;)
+        {
+            Request request;
+            {
+                std::unique_lock<std::mutex> lock(requestMutex);
+                requestAdded.wait(lock, [this]() { return stopping || !requests.empty(); });
+                if (stopping)
+                {
+                    return;
+                }
+                request = requests.front();
+                requests.pop_front();
+            }
+
+            // SDL_image and SDL's pixel conversion don't touch GL and are
+            // safe to call from several threads on different surfaces
+            decode(request);
+        }
+    }
+#endif
+};
+
+#endif // TEXTURELOADER_H
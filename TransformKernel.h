@@ -0,0 +1,208 @@
+#ifndef TRANSFORMKERNEL_H
+#define TRANSFORMKERNEL_H
+
+#include <cmath>
+#include <cstring>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/euler_angles.hpp>
+
+// Structure of arrays input of TransformKernel. Rotations are in degrees:
+// pitch (x), yaw (y) and roll (z), like Scene::trsc().
+struct TRSCArrays
+{
+    const float *positionX, *positionY, *positionZ;
+    const float *rotationX, *rotationY, *rotationZ;
+    const float *scaleX, *scaleY, *scaleZ;
+    const float *centerX, *centerY, *centerZ;
+};
+
+#if defined(__GNUC__) || defined(__clang__)
+#define TRANSFORMKERNEL_VECTOR 1
+
+// Eight lanes of GCC/Clang vector extensions. The compiler lowers them to
+// AVX2, SSE2, NEON or wasm-simd (with -msimd128) depending on the target.
+typedef float TransformLanes __attribute__((vector_size(32)));
+// Unsigned so flipping the sign bit with << 30 is well defined
+typedef unsigned int TransformLaneBits __attribute__((vector_size(32)));
+
+// On x86-64 Linux an AVX2 clone is picked at load time when the CPU has it.
+#if defined(__x86_64__) && defined(__linux__) && !defined(__clang__)
+#define TRANSFORMKERNEL_CLONES __attribute__((target_clones("avx2", "default")))
+#else
+#define TRANSFORMKERNEL_CLONES
+#endif
+
+// Helpers are inlined into whichever clone calls them
+#define TRANSFORMKERNEL_INLINE static inline __attribute__((always_inline))
+
+// sin and cos of x radians for every lane, Cephes style: the angle is
+// reduced to [-pi/4, pi/4] around the nearest quarter turn, both
+// polynomials are evaluated, and the quadrant picks and signs the results.
+// Vectors are passed by reference, by value their ABI depends on the ISA.
+TRANSFORMKERNEL_INLINE void transformLanesSinCos(const TransformLanes &x, TransformLanes &sinOut, TransformLanes &cosOut)
+{
+    // Adding 1.5 * 2^23 rounds to the nearest integer and leaves it in the low mantissa bits
+    const float roundMagic = 12582912.0f;
+    TransformLanes shifted = x * 0.63661977236f + roundMagic; // 2/pi
+    TransformLaneBits quadrant = (TransformLaneBits)shifted & 3;
+    TransformLanes q = shifted - roundMagic;
+
+    // pi/2 split in three parts so the reduction keeps its precision
+    TransformLanes r = ((x - q * 1.5703125f) - q * 4.837512969970703125e-4f) - q * 7.54978995489188216e-8f;
+    TransformLanes r2 = r * r;
+
+    TransformLanes s = r + r * r2 * (-1.6666654611e-1f + r2 * (8.3321608736e-3f + r2 * -1.9515295891e-4f));
+    TransformLanes c = 1.0f - 0.5f * r2 + r2 * r2 * (4.166664568298827e-2f + r2 * (-1.388731625493765e-3f + r2 * 2.443315711809948e-5f));
+
+    // Odd quadrants swap sin and cos, then quadrants 2, 3 negate sin and 1, 2 negate cos
+    TransformLaneBits swap = -(quadrant & 1);
+    TransformLaneBits sinBits = ((TransformLaneBits)c & swap) | ((TransformLaneBits)s & ~swap);
+    TransformLaneBits cosBits = ((TransformLaneBits)s & swap) | ((TransformLaneBits)c & ~swap);
+    sinBits ^= (quadrant & 2) << 30;
+    cosBits ^= ((quadrant + 1) & 2) << 30;
+
+    sinOut = (TransformLanes)sinBits;
+    cosOut = (TransformLanes)cosBits;
+}
+
+TRANSFORMKERNEL_INLINE void transformLanesLoad(TransformLanes &v, const float *p, size_t count)
+{
+    v = TransformLanes();
+    memcpy(&v, p, count * sizeof(float));
+}
+
+// parent * translate(position) * yawPitchRoll(rotation) * scale(scale) * translate(-center)
+// for count nodes, computed eight at a time.
+TRANSFORMKERNEL_CLONES
+static void transformComposeTRSC(const TRSCArrays &in, size_t first, size_t count, const glm::mat4 &parent, glm::mat4 *out)
+{
+    const float degToRad = 0.01745329251994f;
+    const size_t Lanes = sizeof(TransformLanes) / sizeof(float);
+
+    float p[16];
+    for(int col = 0; col < 4; ++col)
+    {
+        for(int row = 0; row < 4; ++row)
+        {
+            p[col * 4 + row] = parent[col][row];
+        }
+    }
+
+    for(size_t block = 0; block < count; block += Lanes)
+    {
+        size_t n = count - block < Lanes ? count - block : Lanes;
+        size_t i = first + block;
+
+        TransformLanes pitch, yaw, roll;
+        transformLanesLoad(pitch, in.rotationX + i, n);
+        transformLanesLoad(yaw, in.rotationY + i, n);
+        transformLanesLoad(roll, in.rotationZ + i, n);
+        pitch *= degToRad;
+        yaw *= degToRad;
+        roll *= degToRad;
+
+        TransformLanes sp, cp, sh, ch, sb, cb;
+        transformLanesSinCos(pitch, sp, cp);
+        transformLanesSinCos(yaw, sh, ch);
+        transformLanesSinCos(roll, sb, cb);
+
+        TransformLanes sx, sy, sz;
+        transformLanesLoad(sx, in.scaleX + i, n);
+        transformLanesLoad(sy, in.scaleY + i, n);
+        transformLanesLoad(sz, in.scaleZ + i, n);
+
+        // Rotation * scale, same terms as glm::yawPitchRoll
+        TransformLanes m[4][3];
+        m[0][0] = (ch * cb + sh * sp * sb) * sx;
+        m[0][1] = (sb * cp) * sx;
+        m[0][2] = (-sh * cb + ch * sp * sb) * sx;
+        m[1][0] = (-ch * sb + sh * sp * cb) * sy;
+        m[1][1] = (cb * cp) * sy;
+        m[1][2] = (sb * sh + ch * sp * cb) * sy;
+        m[2][0] = (sh * cp) * sz;
+        m[2][1] = -sp * sz;
+        m[2][2] = (ch * cp) * sz;
+
+        // Translation, the center is moved to the origin first
+        TransformLanes cx, cy, cz, px, py, pz;
+        transformLanesLoad(cx, in.centerX + i, n);
+        transformLanesLoad(cy, in.centerY + i, n);
+        transformLanesLoad(cz, in.centerZ + i, n);
+        transformLanesLoad(px, in.positionX + i, n);
+        transformLanesLoad(py, in.positionY + i, n);
+        transformLanesLoad(pz, in.positionZ + i, n);
+        m[3][0] = px - (m[0][0] * cx + m[1][0] * cy + m[2][0] * cz);
+        m[3][1] = py - (m[0][1] * cx + m[1][1] * cy + m[2][1] * cz);
+        m[3][2] = pz - (m[0][2] * cx + m[1][2] * cy + m[2][2] * cz);
+
+        // parent * m, column by column. w is 0 for the first three columns, 1 for the last.
+        TransformLanes world[4][4];
+        for(int col = 0; col < 4; ++col)
+        {
+            for(int row = 0; row < 4; ++row)
+            {
+                world[col][row] = p[0 * 4 + row] * m[col][0] + p[1 * 4 + row] * m[col][1] + p[2 * 4 + row] * m[col][2];
+                if (col == 3)
+                {
+                    world[col][row] += p[3 * 4 + row];
+                }
+            }
+        }
+
+        for(size_t lane = 0; lane < n; ++lane)
+        {
+            glm::mat4 &dst = out[block + lane];
+            for(int col = 0; col < 4; ++col)
+            {
+                for(int row = 0; row < 4; ++row)
+                {
+                    dst[col][row] = world[col][row][lane];
+                }
+            }
+        }
+    }
+}
+#endif
+
+// Composes world matrices from TRSC arrays in batches. The vectorized path
+// evaluates sin and cos with polynomials (within a few ulp of std::sin and
+// std::cos), the reference path is the per object glm code it replaces.
+struct TransformKernel
+{
+    static bool vectorized()
+    {
+#ifdef TRANSFORMKERNEL_VECTOR
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    // out[k] = parent * trsc(node first + k), for count nodes.
+    static void composeTRSC(const TRSCArrays &in, size_t first, size_t count, const glm::mat4 &parent, glm::mat4 *out)
+    {
+#ifdef TRANSFORMKERNEL_VECTOR
+        transformComposeTRSC(in, first, count, parent, out);
+#else
+        composeTRSCReference(in, first, count, parent, out);
+#endif
+    }
+
+    static void composeTRSCReference(const TRSCArrays &in, size_t first, size_t count, const glm::mat4 &parent, glm::mat4 *out)
+    {
+        for(size_t k = 0; k < count; ++k)
+        {
+            size_t i = first + k;
+            glm::mat4 m;
+            m  = glm::translate(glm::identity<glm::mat4>(), glm::vec3(in.positionX[i], in.positionY[i], in.positionZ[i]));
+            m *= glm::yawPitchRoll(glm::radians(in.rotationY[i]), glm::radians(in.rotationX[i]), glm::radians(in.rotationZ[i]));
+            m  = glm::scale(m, glm::vec3(in.scaleX[i], in.scaleY[i], in.scaleZ[i]));
+            m  = glm::translate(m, -glm::vec3(in.centerX[i], in.centerY[i], in.centerZ[i]));
+            out[k] = parent * m;
+        }
+    }
+};
+
+#endif // TRANSFORMKERNEL_H
@@ -0,0 +1,95 @@
+#ifndef VERTEXARRAYCACHE_H
+#define VERTEXARRAYCACHE_H
+
+#include <map>
+#include <utility>
+
+#include <glad/glad.h>
+
+#include "GLState.h"
+
+// One Vertex Array Object per (VertexBuffer, ShaderProgram) pair, so the
+// attribute layout is only specified the first time a buffer is drawn with a
+// program. Afterwards binding it is a single glBindVertexArray.
+//
+// Keys are plain pointers so VertexBuffer and ShaderProgram can evict their
+// entries when they are destroyed, before a new object reuses the address.
+struct VertexArrayCache
+{
+    struct VertexArray
+    {
+        GLuint handle = 0;
+        bool specified = false;
+        size_t vertexOffset = 0;
+        const void *instances = NULL;
+        size_t instanceOffset = 0;
+    };
+
+    typedef std::pair<const void*, const void*> Key;
+
+    std::map<Key, VertexArray> vertexArrays;
+    VertexArray *bound = NULL;
+
+    static VertexArrayCache &shared()
+    {
+        static VertexArrayCache cache;
+        return cache;
+    }
+
+    // VAOs need GL 3.0 or GLES 3.0. WebGL 1 keeps specifying the attributes on every bind.
+    static bool supported()
+    {
+        return glGenVertexArrays != NULL;
+    }
+
+    // Binds the VAO of the pair, creating an empty one if needed.
+    VertexArray &bind(const void *vertexBuffer, const void *program)
+    {
+        VertexArray &vertexArray = vertexArrays[Key(vertexBuffer, program)];
+        if (!vertexArray.handle)
+        {
+            glGenVertexArrays(1, &vertexArray.handle);
+        }
+
+        GLState::current().bindVertexArray(vertexArray.handle);
+        bound = &vertexArray;
+        return vertexArray;
+    }
+
+    // Deletes every VAO referencing owner, a VertexBuffer or a ShaderProgram.
+    void evict(const void *owner)
+    {
+        std::map<Key, VertexArray>::iterator it = vertexArrays.begin();
+        while (it != vertexArrays.end())
+        {
+            if (it->first.first == owner || it->first.second == owner || it->second.instances == owner)
+            {
+                if (bound == &it->second)
+                {
+                    bound = NULL;
+                }
+                GLState::current().forgetVertexArray(it->second.handle);
+                glDeleteVertexArrays(1, &it->second.handle);
+                vertexArrays.erase(it++);
+            }
+            else
+            {
+                ++it;
+            }
+        }
+    }
+
+    // Must be called before the GL context goes away.
+    void clear()
+    {
+        for(std::map<Key, VertexArray>::iterator it = vertexArrays.begin(); it != vertexArrays.end(); ++it)
+        {
+            GLState::current().forgetVertexArray(it->second.handle);
+            glDeleteVertexArrays(1, &it->second.handle);
+        }
+        vertexArrays.clear();
+        bound = NULL;
+    }
+};
+
+#endif // VERTEXARRAYCACHE_H
@@ -1,8 +1,15 @@
 #ifndef VERTEXBUFFER_H
 #define VERTEXBUFFER_H
 
+#include <cassert>
+#include <cstring>
+#include <vector>
+
 #include <glad/glad.h>
+#include <SDL2/SDL_log.h>
 
+#include "GLState.h"
+#include "RenderStats.h"
 #include "ShaderProgram.h"
 
 struct VertexBuffer
@@ -16,6 +23,13 @@ struct VertexBuffer
 
     GLuint handle = 0;
 
+    // Ring streaming mode, see allocateRing()
+    GLubyte *mapped = NULL;
+    GLsizeiptr regionSize = 0;
+    int region = 0;
+    GLsizeiptr regionHead = 0;
+    std::vector<GLsync> fences;
+
     VertexBuffer()
     {
         glGenBuffers(1, &handle);
@@ -23,30 +37,232 @@ struct VertexBuffer
 
     ~VertexBuffer()
     {
+        VertexArrayCache::shared().evict(this);
+
+        for(size_t i = 0; i < fences.size(); ++i)
+        {
+            if (fences[i])
+            {
+                glDeleteSync(fences[i]);
+            }
+        }
+
+        if (mapped)
+        {
+            GLState::current().bindBuffer(GL_ARRAY_BUFFER, handle);
+            glUnmapBuffer(GL_ARRAY_BUFFER);
+            mapped = NULL;
+        }
+
+        GLState::current().forgetBuffer(handle);
         glDeleteBuffers(1, &handle);
         handle = 0;
     }
 
-    void bind(ShaderProgram *program)
+    // Allocates the storage once for Stream data written every frame, split
+    // in regionCount regions of regionSize bytes used round-robin. A fence
+    // protects every region so the CPU never writes over data the GPU has
+    // not consumed yet, without re-specifying the storage like upload() does.
+    //
+    // Uses persistently mapped storage (GL 4.4) when available, falls back to
+    // unsynchronized glMapBufferRange (GL 3.2 / GLES 3.0) and finally to
+    // glBufferSubData (WebGL 1). Don't call upload() on a ring buffer.
+    void allocateRing(GLsizeiptr size, int regionCount = 3)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, handle);
+        assert(regionSize == 0 && regionCount > 0);
 
-        for(size_t i = 0; i < program->attributeLocations.size(); ++i)
+        regionSize = size;
+        region = 0;
+        regionHead = 0;
+        fences.assign(regionCount, (GLsync)NULL);
+
+        GLsizeiptr totalSize = regionSize * regionCount;
+        GLState::current().bindBuffer(GL_ARRAY_BUFFER, handle);
+        if (glBufferStorage)
+        {
+            // Dynamic storage keeps the glBufferSubData fallback in stream()
+            // valid if the persistent map fails
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glBufferStorage(GL_ARRAY_BUFFER, totalSize, NULL, flags | GL_DYNAMIC_STORAGE_BIT);
+            mapped = (GLubyte*)glMapBufferRange(GL_ARRAY_BUFFER, 0, totalSize, flags);
+            if (!mapped)
+            {
+                SDL_LogWarn(0, "Could not persistently map a %ld bytes stream buffer", (long)totalSize);
+            }
+        }
+        else
+        {
+            glBufferData(GL_ARRAY_BUFFER, totalSize, NULL, Stream);
+        }
+    }
+
+    // Copies size bytes in the current region and returns their offset in
+    // the buffer. The offset is a multiple of alignment.
+    GLintptr stream(const void *data, GLsizeiptr size, GLsizeiptr alignment)
+    {
+        assert(regionSize > 0 && size <= regionSize);
+
+        GLintptr offset = region * regionSize + regionHead;
+        offset = (offset + alignment - 1) / alignment * alignment;
+        if (offset + size > (region + 1) * regionSize)
+        {
+            // Region full. Move to the next one, which might wait on the GPU.
+            advanceRegion();
+            offset = (region * regionSize + alignment - 1) / alignment * alignment;
+            assert(offset + size <= (region + 1) * regionSize);
+        }
+
+        if (mapped)
+        {
+            memcpy(mapped + offset, data, size);
+        }
+        else
+        {
+            GLState::current().bindBuffer(GL_ARRAY_BUFFER, handle);
+            void *dst = glMapBufferRange ? glMapBufferRange(GL_ARRAY_BUFFER, offset, size, GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT) : NULL;
+            if (dst)
+            {
+                memcpy(dst, data, size);
+                glUnmapBuffer(GL_ARRAY_BUFFER);
+            }
+            else
+            {
+                glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+            }
+        }
+
+        regionHead = offset + size - region * regionSize;
+        return offset;
+    }
+
+    // Streams vertices and returns the index of the first one, to pass to glDrawArrays().
+    template<typename Vertex>
+    GLint stream(const std::vector<Vertex> &vertices)
+    {
+        return (GLint)(stream(vertices.data(), sizeof(Vertex) * vertices.size(), sizeof(Vertex)) / sizeof(Vertex));
+    }
+
+    // Call once per frame after the last draw sourcing the ring.
+    void nextFrame()
+    {
+        if (regionHead > 0)
+        {
+            advanceRegion();
+        }
+    }
+
+    void advanceRegion()
+    {
+        // Fence the commands reading the region we are leaving
+        if (glFenceSync)
+        {
+            fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        }
+
+        region = (region + 1) % (int)fences.size();
+        regionHead = 0;
+
+        if (fences[region])
+        {
+            GLenum result = glClientWaitSync(fences[region], 0, 0);
+            if (result == GL_TIMEOUT_EXPIRED)
+            {
+                RenderStats::frame().streamStalls++;
+                do
+                {
+                    result = glClientWaitSync(fences[region], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+                } while (result == GL_TIMEOUT_EXPIRED);
+            }
+            glDeleteSync(fences[region]);
+            fences[region] = NULL;
+        }
+    }
+
+    // Sources the per-vertex attributes of program from this buffer,
+    // starting offset bytes into it. Binds the cached VAO of this buffer and
+    // program, so the attributes are only specified the first time.
+    void bind(ShaderProgram *program, size_t offset = 0)
+    {
+        if (VertexArrayCache::supported())
         {
-            glVertexAttribPointer(program->attributeLocations[i], program->attributes[i].count, program->attributes[i].type, GL_FALSE, program->vertexSize,  reinterpret_cast<const GLvoid*>(program->attributeOffsets[i]));
+            VertexArrayCache::VertexArray &vertexArray = VertexArrayCache::shared().bind(this, program);
+            if (vertexArray.specified && vertexArray.vertexOffset == offset)
+            {
+                RenderStats::frame().attributeCallsSaved += program->attributeCallCount(false);
+                return;
+            }
+            vertexArray.specified = true;
+            vertexArray.vertexOffset = offset;
         }
 
+        bindAttributes(program, false, offset);
+    }
+
+    // Sources the per-instance attributes (divisor != 0) of program from this
+    // buffer. Call right after binding the per-vertex buffer.
+    void bindInstances(ShaderProgram *program, size_t offset = 0)
+    {
+        VertexArrayCache::VertexArray *vertexArray = VertexArrayCache::shared().bound;
+        if (VertexArrayCache::supported() && vertexArray)
+        {
+            if (vertexArray->instances == this && vertexArray->instanceOffset == offset)
+            {
+                RenderStats::frame().attributeCallsSaved += program->attributeCallCount(true);
+                return;
+            }
+            vertexArray->instances = this;
+            vertexArray->instanceOffset = offset;
+        }
+
+        bindAttributes(program, true, offset);
+    }
+
+    void bindAttributes(ShaderProgram *program, bool perInstance, size_t baseOffset)
+    {
+        GLState::current().bindBuffer(GL_ARRAY_BUFFER, handle);
+        RenderStats::frame().attributeCalls += program->attributeCallCount(perInstance);
+
+        GLint stride = perInstance ? program->instanceSize : program->vertexSize;
+        for(size_t i = 0; i < program->attributeLocations.size(); ++i)
+        {
+            AttributeInfo &attribute = program->attributes[i];
+            if ((attribute.divisor != 0) != perInstance)
+            {
+                continue;
+            }
+
+            GLint components = attribute.componentsPerLocation();
+            for(GLint column = 0; column < program->activeLocationCount(i); ++column)
+            {
+                GLuint location = program->attributeLocations[i] + column;
+                size_t offset = baseOffset + program->attributeOffsets[i] + column * components * attribute.sizeOfType();
+                glVertexAttribPointer(location, components, attribute.type, GL_FALSE, stride, reinterpret_cast<const GLvoid*>(offset));
+
+                // Enabled arrays belong to the VAO, without one ShaderProgram::bind() enables them.
+                if (VertexArrayCache::supported())
+                {
+                    glEnableVertexAttribArray(location);
+                }
+
+                // Divisors belong to the VAO too. Without one they're shared by
+                // every program using this location, so they're always set.
+                if (glVertexAttribDivisor)
+                {
+                    glVertexAttribDivisor(location, attribute.divisor);
+                }
+            }
+        }
     }
 
     void unbind()
     {
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        GLState::current().bindBuffer(GL_ARRAY_BUFFER, 0);
     }
 
     template<typename Vertex>
     void upload(const std::vector<Vertex> &vertices, Hint hint)
     {
-        glBindBuffer(GL_ARRAY_BUFFER, handle);
+        GLState::current().bindBuffer(GL_ARRAY_BUFFER, handle);
         glBufferData(GL_ARRAY_BUFFER, sizeof(Vertex) * vertices.size(), vertices.data(), hint);
     }
 
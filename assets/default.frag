@@ -3,10 +3,23 @@ precision mediump float;
 precision mediump int;
 #endif
 
+#ifdef TEXTURE_ARRAY
+#ifdef GL_ES
+precision mediump sampler2DArray;
+#endif
+// v_texCoord0.p selects the layer
+uniform sampler2DArray u_texture0;
+#else
 uniform sampler2D u_texture0;
+#endif
+
 varying vec4 v_texCoord0;
 
 void main(void)
 {
+#ifdef TEXTURE_ARRAY
+    gl_FragColor = texture(u_texture0, v_texCoord0.stp);
+#else
     gl_FragColor = texture2D(u_texture0, v_texCoord0.st);
+#endif
 }
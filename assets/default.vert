@@ -6,12 +6,28 @@ precision mediump int;
 attribute vec4 a_position;
 attribute vec4 a_texCoord0;
 
-uniform mat4 u_MVP;
+#ifdef HAS_UNIFORM_BUFFERS
+layout(std140) uniform PerView
+{
+    mat4 u_projection;
+    vec4 u_viewport; // xy: display size, zw: vanish point
+};
+#else
+uniform mat4 u_projection;
+uniform vec4 u_viewport;
+#endif
+
+uniform mat4 u_model;
+uniform float u_depthLayer;
 
 varying vec4 v_texCoord0;
 
+// The depth pre-pass and the color pass must produce identical depths
+invariant gl_Position;
+
 void main(void)
 {
-    gl_Position = u_MVP * a_position;
+    gl_Position = u_projection * u_model * a_position;
+    gl_Position.z += u_depthLayer + a_texCoord0.q;
     v_texCoord0 = a_texCoord0;
 }
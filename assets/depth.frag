@@ -0,0 +1,10 @@
+#ifdef GL_ES
+precision mediump float;
+precision mediump int;
+#endif
+
+// Depth pre-pass: only the depth matters, color writes are masked off.
+void main(void)
+{
+    gl_FragColor = vec4(0.0);
+}
@@ -0,0 +1,33 @@
+#ifdef GL_ES
+precision mediump float;
+precision mediump int;
+#endif
+
+attribute vec4 a_position;
+attribute vec4 a_texCoord0;
+attribute mat4 a_model;
+
+#ifdef HAS_UNIFORM_BUFFERS
+layout(std140) uniform PerView
+{
+    mat4 u_projection;
+    vec4 u_viewport; // xy: display size, zw: vanish point
+};
+#else
+uniform mat4 u_projection;
+uniform vec4 u_viewport;
+#endif
+
+uniform float u_depthLayer;
+
+varying vec4 v_texCoord0;
+
+// The depth pre-pass and the color pass must produce identical depths
+invariant gl_Position;
+
+void main(void)
+{
+    gl_Position = u_projection * a_model * a_position;
+    gl_Position.z += u_depthLayer + a_texCoord0.q;
+    v_texCoord0 = a_texCoord0;
+}
@@ -1,12 +1,27 @@
+#include <algorithm>
+#include <cmath>
 #include <iostream>
 
 #include <glm/glm.hpp>
 #include <glm/gtx/euler_angles.hpp>
 
 #include "AttributeInfo.h"
+#include "CompressedFormat.h"
 #include "ShaderProgram.h"
 #include "BaseApp.h"
+#include "FrustumCuller.h"
+#include "GpuTimer.h"
+#include "IndirectBatch.h"
+#include "KtxImage.h"
+#include "OcclusionQuery.h"
+#include "RenderQueue.h"
+#include "Scene.h"
+#include "SpriteBatch.h"
 #include "Texture.h"
+#include "TextureArray.h"
+#include "TextureAtlas.h"
+#include "TextureCache.h"
+#include "TextureLoader.h"
 #include "VertexBuffer.h"
 
 #if __EMSCRIPTEN__
@@ -15,18 +30,105 @@
 
 struct DemoVertex {
     glm::vec3 position;
-    glm::vec2 texCoord;
+    glm::vec4 texCoord; // p: texture array layer, q: depth added to u_depthLayer
 };
 
 struct DemoApp : public BaseApp
 {
+    enum RenderPath
+    {
+        PerDraw,
+        Batched,
+        Instanced,
+        Indirect
+    };
+
+    enum DepthMode
+    {
+        BackToFront,
+        FrontToBack,
+        DepthPrepass
+    };
+
+    // How the sprite batch and indirect paths see background and mike
+    enum SpriteTextures
+    {
+        SeparateTextures,
+        ArrayTextures,
+        AtlasTextures
+    };
+
+    enum MikeSource
+    {
+        MikePNG,
+        MikeCompressed,
+        MikeDecompressed
+    };
+
+    // Programs and uniform locations the draw functions use: the textured
+    // color pass or the depth-only pre-pass.
+    struct Pass
+    {
+        ShaderProgram *program;
+        ShaderProgram *instancedProgram;
+        GLint u_model;
+        GLint u_depthLayer;
+        GLint u_texture0;
+        GLint u_instancedDepthLayer;
+        GLint u_instancedTexture0;
+        ShaderProgram *arrayProgram;
+        GLint u_arrayModel;
+        GLint u_arrayDepthLayer;
+        GLint u_arrayTexture0;
+    };
+
     ShaderProgram *defaultProgram = NULL;
+    ShaderProgram *instancedProgram = NULL;
+    ShaderProgram *depthProgram = NULL;
+    ShaderProgram *depthInstancedProgram = NULL;
+    ShaderProgram *arrayProgram = NULL;
+    Pass colorPass = {};
+    Pass depthPass = {};
+    Pass *pass = &colorPass;
+    VertexBuffer *instanceVBO = NULL;
+    SpriteBatch *spriteBatch = NULL;
+    IndirectBatch *indirectBatch = NULL;
+    GLint mikeMesh = 0;
+    GLint backgroundMesh = 0;
+    RenderQueue renderQueue;
     Texture *backgroundTex = NULL;
     VertexBuffer *backgroundVBO = NULL;
     Texture *mikeTex = NULL;
     VertexBuffer *mikeVBO = NULL;
+
+    // mike.png whatever mikeTex is. Held, with the background's pixels,
+    // until the sprite array and atlas are built from them.
+    Texture *mikeSpriteTex = NULL;
+
+    // Background and mike as layers of one texture, so the sprite batch
+    // draws both without a texture switch.
+    TextureArray *spriteArray = NULL;
+    TextureLoader *textureLoader = NULL;
+    TextureCache *textureCache = NULL;
+    int backgroundLayer = 0;
+    int mikeLayer = 0;
+
+    // Background and mike packed in one atlas page, with their own copies
+    // of the quads mapping into it
+    TextureAtlas *spriteAtlas = NULL;
+    std::vector<DemoVertex> backgroundAtlasVertices;
+    std::vector<DemoVertex> mikeAtlasVertices;
+    GLint backgroundAtlasMesh = 0;
+    GLint mikeAtlasMesh = 0;
+    int spriteTextures = ArrayTextures;
+    int mikeSource = MikePNG;
+    int textureFilter = Texture::Trilinear;
+    float textureAnisotropy = 1.0f;
     bool useOrtho = false;
-    bool useFrontToBack = true;
+    int depthMode = FrontToBack;
+    int renderPath = PerDraw;
+    int stressLevel = 0;
+    bool useCulling = true;
     float fieldOfView = 45.0f;
     glm::vec2 vanishPoint = glm::vec3(0.0f);
     glm::vec3 mikePosition = glm::vec3(0.0f);
@@ -35,26 +137,84 @@ struct DemoApp : public BaseApp
     glm::vec3 mikeCenterPoint = glm::vec3(0.0f);
 
     std::vector<DemoVertex> backgroundVertices = {
-        //{   X       Y       Z  }  { S     T  }
-        { {  0.0f,   0.0f,   0.0f}, {0.0f, 0.0f} },
-        {   {0.0f, 600.0f,   0.0f}, {0.0f, 1.0f} },
-        { {800.0f,   0.0f,   0.0f}, {1.0f, 0.0f} },
-        { {800.0f, 600.0f,   0.0f}, {1.0f, 1.0f} },
+        //{   X       Y       Z  }  { S     T     P     Q  }
+        { {  0.0f,   0.0f,   0.0f}, {0.0f, 0.0f, 0.0f, 0.0f} },
+        {   {0.0f, 600.0f,   0.0f}, {0.0f, 1.0f, 0.0f, 0.0f} },
+        { {800.0f,   0.0f,   0.0f}, {1.0f, 0.0f, 0.0f, 0.0f} },
+        { {800.0f, 600.0f,   0.0f}, {1.0f, 1.0f, 0.0f, 0.0f} },
     };
 
     std::vector<DemoVertex> mikeVertices = {
-        //{   X       Y       Z  }  { S     T  }
-        { {  0.0f,   0.0f,   0.0f}, {0.0f, 0.0f} },
-        {   {0.0f, 512.0f,   0.0f}, {0.0f, 1.0f} },
-        { {512.0f,   0.0f,   0.0f}, {1.0f, 0.0f} },
-        { {512.0f, 512.0f,   0.0f}, {1.0f, 1.0f} },
+        //{   X       Y       Z  }  { S     T     P     Q  }
+        { {  0.0f,   0.0f,   0.0f}, {0.0f, 0.0f, 0.0f, 0.0f} },
+        {   {0.0f, 512.0f,   0.0f}, {0.0f, 1.0f, 0.0f, 0.0f} },
+        { {512.0f,   0.0f,   0.0f}, {1.0f, 0.0f, 0.0f, 0.0f} },
+        { {512.0f, 512.0f,   0.0f}, {1.0f, 1.0f, 0.0f, 0.0f} },
     };
 
     glm::mat4 projectionMatrix;
     glm::mat4 modelMatrix;
 
-    GLint u_MVP = 0;
-    GLint u_texture0 = 0;
+    // Matrices are only recomputed when one of their inputs changed. The
+    // Control Panel widgets raise these flags, the display size is compared
+    // every frame.
+    bool projectionDirty = true;
+    bool modelDirty = true;
+    bool cullingDirty = true;
+    int projectionWidth = 0;
+    int projectionHeight = 0;
+
+    // The background and mike are roots of the scene. The stress test
+    // replaces mike by a grid of small mikes, children of mike tiled over
+    // its own 512x512 quad, always the last nodes of the scene.
+    Scene scene;
+    int backgroundNode = 0;
+    int mikeNode = 0;
+    size_t copyCount = 0;
+
+    // Spins every mike drawn, so all their matrices change every frame
+    bool animate = false;
+    float transformMs = 0.0f;
+
+    // Vectorized TRSC kernel against the per object glm code
+    struct TransformBenchmark
+    {
+        size_t count;
+        double referenceMs;
+        double kernelMs;
+        float maxError;
+    };
+    TransformBenchmark transformBenchmark = {};
+
+    // CPU pre-transformed sprites (the Sprite Batch path) against a model
+    // uniform per draw and instancing, for growing mike counts
+    struct DrawBenchmark
+    {
+        static const int Steps = 8;
+        int counts[Steps];
+        double ms[3][Steps]; // Per Draw, Sprite Batch, Instanced
+        int batchedCrossover;   // first count where batching beats per draw, 0 if never
+        int instancedCrossover; // first count where instancing beats batching, 0 if never
+    };
+    DrawBenchmark drawBenchmark = {};
+    bool drawBenchmarkRequested = false;
+
+    // Bounds of every mike followed by the background, tested against the
+    // view frustum before anything is submitted.
+    FrustumCuller culler;
+    size_t visibleCount = 0;
+    std::vector<glm::mat4> visibleModels;
+
+    // In Front to Back mode the background is tested against the depth mike
+    // leaves behind, and skipped while it is fully hidden.
+    OcclusionQuery backgroundQuery;
+
+    // Constant clip space depth of the layer being drawn in Front to Back mode
+    float depthLayer = 0.0f;
+
+    // GPU time of the scene, averaged per depth mode for comparison
+    GpuTimer sceneTimer;
+    float depthModeTimes[3] = {};
 
     virtual bool userInit() override
     {
@@ -71,8 +231,8 @@ struct DemoApp : public BaseApp
         }
 
         std::vector<AttributeInfo> defaultAttributes = {
-            {"a_position", AttributeInfo::Float, 3},
-            {"a_texCoord0", AttributeInfo::Float, 2},
+            {"a_position", AttributeInfo::Float, 3, 0},
+            {"a_texCoord0", AttributeInfo::Float, 4, 0},
         };
 
         defaultProgram = new ShaderProgram(defaultAttributes);
@@ -83,27 +243,128 @@ struct DemoApp : public BaseApp
             return false;
         }
 
-        u_MVP      = defaultProgram->getUniformLocation("u_MVP");
-        u_texture0 = defaultProgram->getUniformLocation("u_texture0");
+        colorPass.program      = defaultProgram;
+        colorPass.u_model      = defaultProgram->getUniformLocation("u_model");
+        colorPass.u_depthLayer = defaultProgram->getUniformLocation("u_depthLayer");
+        colorPass.u_texture0   = defaultProgram->getUniformLocation("u_texture0");
 
-        backgroundTex = new Texture("assets/background.jpg");
-        if (backgroundTex->decode() != 0)
+        // Same vertex shader, so both passes produce the exact same depth
+        Shader depthFrag("assets/depth.frag");
+        if (depthFrag.compile() != 0)
         {
             return false;
         }
 
-        backgroundVBO = new VertexBuffer();
-        backgroundVBO->upload(backgroundVertices, VertexBuffer::Static);
-
-        mikeTex = new Texture("assets/mike.png");
-        if (mikeTex->decode() != 0)
+        depthProgram = new ShaderProgram(defaultAttributes);
+        depthProgram->attach(&defaultVert);
+        depthProgram->attach(&depthFrag);
+        if (depthProgram->link() != 0)
         {
             return false;
         }
 
+        depthPass.program      = depthProgram;
+        depthPass.u_model      = depthProgram->getUniformLocation("u_model");
+        depthPass.u_depthLayer = depthProgram->getUniformLocation("u_depthLayer");
+        depthPass.u_texture0   = -1;
+
+        // Depth only, the sprite batch needs no texture either
+        depthPass.arrayProgram      = depthProgram;
+        depthPass.u_arrayModel      = depthPass.u_model;
+        depthPass.u_arrayDepthLayer = depthPass.u_depthLayer;
+        depthPass.u_arrayTexture0   = -1;
+
+        // Instancing requires GL 3.3 or GLES 3.0
+        if (glDrawArraysInstanced && glVertexAttribDivisor)
+        {
+            Shader instancedVert("assets/instanced.vert");
+            if (instancedVert.compile() != 0)
+            {
+                return false;
+            }
+
+            std::vector<AttributeInfo> instancedAttributes = {
+                {"a_position", AttributeInfo::Float, 3, 0},
+                {"a_texCoord0", AttributeInfo::Float, 4, 0},
+                {"a_model", AttributeInfo::Float, 16, 1},
+            };
+
+            instancedProgram = new ShaderProgram(instancedAttributes);
+            instancedProgram->attach(&instancedVert);
+            instancedProgram->attach(&defaultFrag);
+            if (instancedProgram->link() != 0)
+            {
+                return false;
+            }
+
+            colorPass.instancedProgram      = instancedProgram;
+            colorPass.u_instancedDepthLayer = instancedProgram->getUniformLocation("u_depthLayer");
+            colorPass.u_instancedTexture0   = instancedProgram->getUniformLocation("u_texture0");
+
+            depthInstancedProgram = new ShaderProgram(instancedAttributes);
+            depthInstancedProgram->attach(&instancedVert);
+            depthInstancedProgram->attach(&depthFrag);
+            if (depthInstancedProgram->link() != 0)
+            {
+                return false;
+            }
+
+            depthPass.instancedProgram      = depthInstancedProgram;
+            depthPass.u_instancedDepthLayer = depthInstancedProgram->getUniformLocation("u_depthLayer");
+            depthPass.u_instancedTexture0   = -1;
+
+            instanceVBO = new VertexBuffer();
+        }
+
+        textureLoader = new TextureLoader();
+        textureCache = new TextureCache(textureLoader);
+
+        // Sprite images first, so the loads keep their pixels
+        backgroundTex = textureCache->acquire("assets/background.jpg", false, true);
+        backgroundTex->setSampling((Texture::Filter)textureFilter, textureAnisotropy);
+        mikeSpriteTex = textureCache->acquire("assets/mike.png", false, true);
+
+        backgroundVBO = new VertexBuffer();
+        backgroundVBO->upload(backgroundVertices, VertexBuffer::Static);
+
+        CompressedFormat::detect();
+        loadMikeTexture();
+
         mikeVBO = new VertexBuffer();
         mikeVBO->upload(mikeVertices, VertexBuffer::Static);
 
+        // Texture arrays require GL 3.0 or GLES 3.0
+        if (TextureArray::supported() && Shader::glslVersion() != 0)
+        {
+            Shader arrayFrag("assets/default.frag", "#define TEXTURE_ARRAY 1\n");
+            if (arrayFrag.compile() != 0)
+            {
+                return false;
+            }
+
+            arrayProgram = new ShaderProgram(defaultAttributes);
+            arrayProgram->attach(&defaultVert);
+            arrayProgram->attach(&arrayFrag);
+            if (arrayProgram->link() != 0)
+            {
+                return false;
+            }
+
+            colorPass.arrayProgram      = arrayProgram;
+            colorPass.u_arrayModel      = arrayProgram->getUniformLocation("u_model");
+            colorPass.u_arrayDepthLayer = arrayProgram->getUniformLocation("u_depthLayer");
+            colorPass.u_arrayTexture0   = arrayProgram->getUniformLocation("u_texture0");
+        }
+
+        spriteBatch = new SpriteBatch();
+
+        indirectBatch = new IndirectBatch();
+        mikeMesh = indirectBatch->addMesh(mikeVertices);
+        backgroundMesh = indirectBatch->addMesh(backgroundVertices);
+
+        backgroundNode = scene.addNode();
+        mikeNode = scene.addNode();
+
         // Vanish point initially the center of the screen
         vanishPoint.x = displayWidth * 0.5f;
         vanishPoint.y = displayHeight * 0.5f;
@@ -124,49 +385,384 @@ struct DemoApp : public BaseApp
 
     virtual void userShutdown() override
     {
+        // Stops the workers before the textures they decode into go away
+        delete textureLoader;
+        textureLoader = NULL;
+
         delete defaultProgram;
         defaultProgram = NULL;
 
-        delete backgroundTex;
+        delete instancedProgram;
+        instancedProgram = NULL;
+
+        delete depthProgram;
+        depthProgram = NULL;
+
+        delete depthInstancedProgram;
+        depthInstancedProgram = NULL;
+
+        delete arrayProgram;
+        arrayProgram = NULL;
+
+        delete spriteArray;
+        spriteArray = NULL;
+
+        delete spriteAtlas;
+        spriteAtlas = NULL;
+
+        delete instanceVBO;
+        instanceVBO = NULL;
+
+        releaseSpriteImages();
+        textureCache->release(backgroundTex);
         backgroundTex = NULL;
 
         delete backgroundVBO;
         backgroundVBO = NULL;
 
-        delete mikeTex;
+        textureCache->release(mikeTex);
         mikeTex = NULL;
 
+        delete textureCache;
+        textureCache = NULL;
+
         delete mikeVBO;
         mikeVBO = NULL;
+
+        delete spriteBatch;
+        spriteBatch = NULL;
+
+        delete indirectBatch;
+        indirectBatch = NULL;
+
+        backgroundQuery.release();
+        sceneTimer.release();
+    }
+
+    void updateStressTest()
+    {
+        static const size_t stressCounts[] = { 0, 1000, 10000, 100000 };
+        size_t count = stressCounts[stressLevel];
+
+        if (count == copyCount)
+        {
+            return;
+        }
+
+        scene.truncate(mikeNode + 1);
+
+        size_t columns = (size_t)std::ceil(std::sqrt((float)count));
+        float cellSize = 512.0f / columns;
+        for(size_t i = 0; i < count; ++i)
+        {
+            glm::vec3 cellCenter((i % columns + 0.5f) * cellSize, (i / columns + 0.5f) * cellSize, 0.0f);
+            int node = scene.addNode(mikeNode);
+            scene.setTRSC(node, cellCenter, glm::vec3(0.0f), glm::vec3(cellSize / 512.0f, cellSize / 512.0f, 1.0f), glm::vec3(256.0f, 256.0f, 0.0f));
+        }
+        copyCount = count;
+    }
+
+    // Mikes actually drawn: mike itself, or its stress test copies.
+    size_t mikeCount() const
+    {
+        return copyCount ? copyCount : 1;
+    }
+
+    int mikeNodeAt(size_t i) const
+    {
+        return copyCount ? mikeNode + 1 + (int)i : mikeNode;
+    }
+
+    const glm::mat4 &mikeModel(size_t i) const
+    {
+        return scene.world(mikeNodeAt(i));
+    }
+
+    // Bounds follow the models, the visibility is only tested again when
+    // the bounds or the frustum moved.
+    void cullObjects(bool modelsChanged)
+    {
+        size_t count = mikeCount();
+        bool resized = culler.size() != count + 1;
+
+        if (resized || modelsChanged)
+        {
+            culler.resize(count + 1);
+            for(size_t i = 0; i < count; ++i)
+            {
+                if (resized || scene.changed[mikeNodeAt(i)])
+                {
+                    culler.setBounds(i, mikeModel(i), glm::vec3(0.0f), glm::vec3(512.0f, 512.0f, 0.0f));
+                }
+            }
+            if (resized || scene.changed[backgroundNode])
+            {
+                culler.setBounds(count, scene.world(backgroundNode), glm::vec3(0.0f), glm::vec3(800.0f, 600.0f, 0.0f));
+            }
+            cullingDirty = true;
+        }
+
+        if (cullingDirty)
+        {
+            if (useCulling)
+            {
+                visibleCount = culler.cull();
+            }
+            else
+            {
+                culler.visible.assign(count + 1, 1);
+                visibleCount = count + 1;
+            }
+            cullingDirty = false;
+        }
+
+        RenderStats::frame().objectsVisible = (int)visibleCount;
+        RenderStats::frame().objectsCulled = (int)(count + 1 - visibleCount);
     }
 
     void drawMike()
     {
         // Draw mike
-        // set vanishing point
-        if (!useOrtho) {
-            float vpx = vanishPoint.x;
-            float vpy = displayHeight - vanishPoint.y;
-            projectionMatrix[2][0] = (2.0f * vpx /  displayWidth) - 1.0f;
-            projectionMatrix[2][1] = (2.0f * vpy / displayHeight) - 1.0f;
+        if (renderPath == Instanced && pass->instancedProgram)
+        {
+            drawMikeInstanced();
+            return;
+        }
+
+        for(size_t i = 0; i < mikeCount(); ++i)
+        {
+            if (culler.visible[i])
+            {
+                drawMike(mikeModel(i));
+            }
+        }
+    }
+
+    void drawMike(const glm::mat4 &model)
+    {
+        if (renderPath == Batched)
+        {
+            spriteBatch->setDepthLayer(depthLayer);
+            if (batchesTextureArray())
+            {
+                spriteBatch->draw(spriteArray, mikeLayer, mikeVertices, model);
+            }
+            else if (usesAtlas())
+            {
+                spriteBatch->draw(spriteAtlas->texture(0), mikeAtlasVertices, model);
+            }
+            else
+            {
+                spriteBatch->draw(mikeTex, mikeVertices, model);
+            }
+            return;
+        }
+
+        if (renderPath == Indirect)
+        {
+            if (usesAtlas())
+            {
+                indirectBatch->draw(mikeAtlasMesh, spriteAtlas->texture(0), model, depthLayer);
+            }
+            else
+            {
+                indirectBatch->draw(mikeMesh, mikeTex, model, depthLayer);
+            }
+            return;
         }
-        defaultProgram->setUniform(u_MVP, projectionMatrix * modelMatrix);
-        mikeVBO->bind(defaultProgram);
+
+        DrawCommand command = {
+            pass->program, pass->u_model, model, pass->u_depthLayer, depthLayer,
+            mikeTex, mikeVBO, GL_TRIANGLE_STRIP, 0, (GLsizei)mikeVertices.size(),
+            0.0f, DrawCommand::Opaque
+        };
+        renderQueue.submit(command);
+    }
+
+    void drawMikeInstanced()
+    {
+        visibleModels.clear();
+        for(size_t i = 0; i < mikeCount(); ++i)
+        {
+            if (culler.visible[i])
+            {
+                visibleModels.push_back(mikeModel(i));
+            }
+        }
+
+        drawInstances(visibleModels);
+    }
+
+    void drawInstances(const std::vector<glm::mat4> &models)
+    {
+        if (models.empty())
+        {
+            return;
+        }
+
+        // Keep the painter's order with what is already queued
+        renderQueue.execute();
+
+        // One draw call for every mike, the model matrices come from a per-instance attribute stream.
+        pass->program->unbind();
+        pass->instancedProgram->bind();
+        pass->instancedProgram->setUniform(pass->u_instancedDepthLayer, depthLayer);
+        pass->instancedProgram->setUniform(pass->u_instancedTexture0, 0);
+
+        instanceVBO->upload(models, VertexBuffer::Stream);
+        mikeVBO->bind(pass->instancedProgram);
+        instanceVBO->bindInstances(pass->instancedProgram);
         mikeTex->bind();
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei)mikeVertices.size());
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, (GLsizei)mikeVertices.size(), (GLsizei)models.size());
+        RenderStats::frame().drawCalls++;
+        RenderStats::frame().instancesDrawn += (int)models.size();
+
+        pass->instancedProgram->unbind();
+        pass->program->bind();
     }
 
     void drawBackground()
     {
         // Draw the background
-        defaultProgram->setUniform(u_MVP, projectionMatrix); // No Model transforms for the background.
-        backgroundVBO->bind(defaultProgram);
-        backgroundTex->bind();
-        glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei)backgroundVertices.size());
+        if (!culler.visible.back())
+        {
+            return;
+        }
+
+        // The background node keeps an identity transform
+        const glm::mat4 &model = scene.world(backgroundNode);
+
+        if (renderPath == Batched)
+        {
+            spriteBatch->setDepthLayer(depthLayer);
+            if (batchesTextureArray())
+            {
+                spriteBatch->draw(spriteArray, backgroundLayer, backgroundVertices, model);
+            }
+            else if (usesAtlas())
+            {
+                spriteBatch->draw(spriteAtlas->texture(0), backgroundAtlasVertices, model);
+            }
+            else
+            {
+                spriteBatch->draw(backgroundTex, backgroundVertices, model);
+            }
+            return;
+        }
+
+        if (renderPath == Indirect)
+        {
+            if (usesAtlas())
+            {
+                indirectBatch->draw(backgroundAtlasMesh, spriteAtlas->texture(0), model, depthLayer);
+            }
+            else
+            {
+                indirectBatch->draw(backgroundMesh, backgroundTex, model, depthLayer);
+            }
+            return;
+        }
+
+        DrawCommand command = {
+            pass->program, pass->u_model, model, pass->u_depthLayer, depthLayer,
+            backgroundTex, backgroundVBO, GL_TRIANGLE_STRIP, 0, (GLsizei)backgroundVertices.size(),
+            1.0f, DrawCommand::Opaque // Behind mike
+        };
+        renderQueue.submit(command);
     }
 
+    bool batchesTextureArray() const
+    {
+        return renderPath == Batched && spriteTextures == ArrayTextures && spriteArray;
+    }
 
-    virtual void userRender() override
+    bool usesAtlas() const
+    {
+        return (renderPath == Batched || renderPath == Indirect) && spriteTextures == AtlasTextures && spriteAtlas;
+    }
+
+    void usePass(Pass *newPass)
+    {
+        pass = newPass;
+        if (batchesTextureArray())
+        {
+            pass->arrayProgram->bind();
+            pass->arrayProgram->setUniform(pass->u_arrayTexture0, 0);
+            spriteBatch->setProgram(pass->arrayProgram, pass->u_arrayModel, pass->u_arrayDepthLayer);
+        }
+        else
+        {
+            spriteBatch->setProgram(pass->program, pass->u_model, pass->u_depthLayer);
+        }
+        pass->program->bind();
+        pass->program->setUniform(pass->u_texture0, 0);
+        indirectBatch->setPrograms(pass->instancedProgram, pass->u_instancedDepthLayer, pass->program, pass->u_model, pass->u_depthLayer);
+    }
+
+    // Everything queued so far reaches the depth buffer.
+    void flushDraws()
+    {
+        renderQueue.execute();
+        indirectBatch->end();
+        spriteBatch->flush();
+        pass->program->bind();
+    }
+
+    void drawBackgroundTested()
+    {
+        if (!OcclusionQuery::supported() || !culler.visible.back())
+        {
+            drawBackground();
+            return;
+        }
+
+        flushDraws();
+
+        if (backgroundQuery.occluded())
+        {
+            // Keep testing its bounds so it comes back as soon as it shows
+            RenderStats::frame().occlusionSkipped++;
+            if (backgroundQuery.begin())
+            {
+                drawBackgroundProxy();
+                backgroundQuery.end();
+            }
+            return;
+        }
+
+        bool conditional = backgroundQuery.beginConditional();
+        bool measuring = backgroundQuery.begin();
+
+        drawBackground();
+        flushDraws();
+
+        if (measuring)
+        {
+            backgroundQuery.end();
+        }
+        if (conditional)
+        {
+            backgroundQuery.endConditional();
+        }
+    }
+
+    // Depth tested bounds of the background, without writing anything.
+    void drawBackgroundProxy()
+    {
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glDepthMask(GL_FALSE);
+
+        pass->program->setUniform(pass->u_model, scene.world(backgroundNode));
+        pass->program->setUniform(pass->u_depthLayer, depthLayer);
+        backgroundVBO->bind(pass->program);
+        glDrawArrays(GL_TRIANGLE_STRIP, 0, (GLsizei)backgroundVertices.size());
+        RenderStats::frame().drawCalls++;
+
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+    }
+
+    void updateProjection()
     {
         if (useOrtho)
         {
@@ -181,31 +777,439 @@ struct DemoApp : public BaseApp
             projectionMatrix = glm::perspective(fieldOfViewRad, aspectRatio, 0.1f, cameraDistance+512.0f);
             projectionMatrix = glm::rotate(projectionMatrix, glm::radians(180.0f), glm::vec3(1, 0, 0));
             projectionMatrix = glm::translate(projectionMatrix, glm::vec3(-displayWidth*0.5f, -displayHeight*0.5f, cameraDistance));
-        }
 
-        // Order matters. We use TRSC (Translate, Rotate, Scale, Center)
-        modelMatrix  = glm::translate(glm::identity<glm::mat4>(), mikePosition);
-        modelMatrix *= glm::yawPitchRoll(glm::radians(mikeRotation.y), glm::radians(mikeRotation.x), glm::radians(mikeRotation.z));
-        modelMatrix  = glm::scale(modelMatrix, mikeScale);
-        modelMatrix  = glm::translate(modelMatrix, -mikeCenterPoint);
+            // set vanishing point. Only affects vertices off the z = 0 plane,
+            // so it is safe to share it between mike and the background.
+            float vpx = vanishPoint.x;
+            float vpy = displayHeight - vanishPoint.y;
+            projectionMatrix[2][0] = (2.0f * vpx /  displayWidth) - 1.0f;
+            projectionMatrix[2][1] = (2.0f * vpy / displayHeight) - 1.0f;
+        }
 
-        defaultProgram->bind();
-        defaultProgram->setUniform(u_texture0, 0);
+        // Culling uses the real frustum, before z gets flattened below
+        culler.setFrustum(projectionMatrix);
 
-        if (useFrontToBack) {
-            glEnable(GL_DEPTH_TEST);
+        if (depthMode != BackToFront)
+        {
+            // Flatten z, every layer gets its own constant depth from u_depthLayer
+            // (or texCoord.q for batched sprites).
             projectionMatrix[2][2] = 0.0f;
-
             projectionMatrix[3][2] = 0.0f;
-            drawMike();
+        }
+
+        // Shared by every program, uploaded once for the frame
+        PerView view;
+        view.projection = projectionMatrix;
+        view.viewport = glm::vec4((float)displayWidth, (float)displayHeight, vanishPoint.x, vanishPoint.y);
+        PerViewBuffer::shared().update(view);
+
+        projectionWidth = displayWidth;
+        projectionHeight = displayHeight;
+        projectionDirty = false;
+        cullingDirty = true;
+        RenderStats::frame().matricesUpdated++;
+    }
+
+    virtual bool userIsAnimating() override
+    {
+        return animate || textureLoader->busy();
+    }
+
+    // PNG, or the KTX 2 variant in the best format the context samples.
+    // Mesa's software drivers sample all of them, the decompressed source
+    // exercises the CPU decoders anyway.
+    void loadMikeTexture()
+    {
+        std::string filePath = "assets/mike.png";
+        if (mikeSource != MikePNG)
+        {
+            std::vector<std::string> variants = { "assets/mike.bc1.ktx2", "assets/mike.etc2.ktx2" };
+            std::string variant = KtxImage::pickVariant(variants);
+            if (!variant.empty())
+            {
+                filePath = variant;
+            }
+        }
+
+        // Acquire first, going back to a resident source doesn't decode again.
+        // Without a KTX variant there's nothing to decompress, the PNG is shared.
+        Texture *previous = mikeTex;
+        mikeTex = textureCache->acquire(filePath, mikeSource == MikeDecompressed && KtxImage::isKtx(filePath));
+        mikeTex->setSampling((Texture::Filter)textureFilter, textureAnisotropy);
+        if (previous)
+        {
+            textureCache->release(previous);
+        }
+    }
+
+    // Level of detail the GPU picks for mike's texture: log2 of how many
+    // texels land on each pixel side, from the projected area of the quad.
+    // Returns -1 when mike is behind the camera or not loaded.
+    float mikeSampledLevel()
+    {
+        if (!mikeTex->isReady())
+        {
+            return -1.0f;
+        }
+
+        glm::mat4 mvp = projectionMatrix * mikeModel(0);
+        const int corners[4] = { 0, 1, 3, 2 };
+        glm::vec2 screen[4];
+        for(int c = 0; c < 4; ++c)
+        {
+            glm::vec4 clip = mvp * glm::vec4(mikeVertices[corners[c]].position, 1.0f);
+            if (clip.w <= 0.0f)
+            {
+                return -1.0f;
+            }
+            screen[c] = glm::vec2((clip.x / clip.w * 0.5f + 0.5f) * displayWidth, (clip.y / clip.w * 0.5f + 0.5f) * displayHeight);
+        }
+
+        float area = 0.0f;
+        for(int c = 0; c < 4; ++c)
+        {
+            const glm::vec2 &a = screen[c];
+            const glm::vec2 &b = screen[(c + 1) % 4];
+            area += a.x * b.y - b.x * a.y;
+        }
+        area = std::fabs(area) * 0.5f;
+        if (area < 1.0f)
+        {
+            return -1.0f;
+        }
+
+        float texelsPerPixel = (float)mikeTex->width * mikeTex->height / area;
+        return std::max(0.0f, 0.5f * std::log2(texelsPerPixel));
+    }
+
+    // The sprite array and atlas are built from the pixels the loader kept
+    // for both images, once both are decoded.
+    bool spriteImagesReady() const
+    {
+        return mikeSpriteTex && backgroundTex->pixels && mikeSpriteTex->pixels;
+    }
+
+    // Called once the array and atlas exist, or the images failed to load
+    void releaseSpriteImages()
+    {
+        if (!mikeSpriteTex)
+        {
+            return;
+        }
+
+        backgroundTex->releasePixels();
+        mikeSpriteTex->releasePixels();
+        textureCache->release(mikeSpriteTex);
+        mikeSpriteTex = NULL;
+    }
+
+    // The array is sized after the largest sprite. Called when loads complete.
+    void createSpriteArray()
+    {
+        if (spriteArray || !arrayProgram || !spriteImagesReady())
+        {
+            return;
+        }
+
+        SDL_Surface *background = backgroundTex->pixels;
+        SDL_Surface *mike = mikeSpriteTex->pixels;
+        spriteArray = new TextureArray(std::max(background->w, mike->w), std::max(background->h, mike->h), 2);
+        backgroundLayer = spriteArray->add((const unsigned char *)background->pixels, background->w, background->h, background->pitch);
+        mikeLayer = spriteArray->add((const unsigned char *)mike->pixels, mike->w, mike->h, mike->pitch);
+        if (backgroundLayer < 0 || mikeLayer < 0)
+        {
+            delete spriteArray;
+            spriteArray = NULL;
+        }
+    }
+
+    // Both images fit side by side in one 2048x1024 page, so drawing them
+    // no longer switches textures. Packed from the same kept pixels as the
+    // array.
+    void createSpriteAtlas()
+    {
+        if (spriteAtlas || !spriteImagesReady())
+        {
+            return;
+        }
+
+        SDL_Surface *background = backgroundTex->pixels;
+        SDL_Surface *mike = mikeSpriteTex->pixels;
+        spriteAtlas = new TextureAtlas(2048, 1024);
+        int backgroundRegion = spriteAtlas->add((const unsigned char *)background->pixels, background->w, background->h, background->pitch);
+        int mikeRegion = spriteAtlas->add((const unsigned char *)mike->pixels, mike->w, mike->h, mike->pitch);
+        if (backgroundRegion < 0 || mikeRegion < 0 || spriteAtlas->pages.size() > 1)
+        {
+            delete spriteAtlas;
+            spriteAtlas = NULL;
+            return;
+        }
+
+        backgroundAtlasVertices = backgroundVertices;
+        spriteAtlas->rewriteTexCoords(backgroundRegion, backgroundAtlasVertices);
+        mikeAtlasVertices = mikeVertices;
+        spriteAtlas->rewriteTexCoords(mikeRegion, mikeAtlasVertices);
+
+        backgroundAtlasMesh = indirectBatch->addMesh(backgroundAtlasVertices);
+        mikeAtlasMesh = indirectBatch->addMesh(mikeAtlasVertices);
+    }
+
+    // Composes 100k random transforms with both paths, best of 5 runs each.
+    void runTransformBenchmark()
+    {
+        const size_t count = 100000;
+        const int runs = 5;
+
+        std::vector<float> values[12];
+        for(int a = 0; a < 12; ++a)
+        {
+            values[a].resize(count);
+            for(size_t i = 0; i < count; ++i)
+            {
+                float unit = (float)((i * 2654435761u + a * 40503u) % 10007) / 10007.0f;
+                values[a][i] = a >= 6 && a < 9 ? 0.25f + unit * 2.0f : unit * 720.0f - 360.0f; // scales, else angles/positions
+            }
+        }
+
+        TRSCArrays in = {
+            values[0].data(), values[1].data(), values[2].data(),
+            values[3].data(), values[4].data(), values[5].data(),
+            values[6].data(), values[7].data(), values[8].data(),
+            values[9].data(), values[10].data(), values[11].data(),
+        };
+
+        std::vector<glm::mat4> reference(count);
+        std::vector<glm::mat4> kernel(count);
+        double frequency = (double)SDL_GetPerformanceFrequency();
+
+        transformBenchmark = TransformBenchmark();
+        transformBenchmark.count = count;
+        transformBenchmark.referenceMs = 1e9;
+        transformBenchmark.kernelMs = 1e9;
+        for(int run = 0; run < runs; ++run)
+        {
+            Uint64 start = SDL_GetPerformanceCounter();
+            TransformKernel::composeTRSCReference(in, 0, count, modelMatrix, reference.data());
+            Uint64 middle = SDL_GetPerformanceCounter();
+            TransformKernel::composeTRSC(in, 0, count, modelMatrix, kernel.data());
+            Uint64 end = SDL_GetPerformanceCounter();
+
+            transformBenchmark.referenceMs = std::min(transformBenchmark.referenceMs, (middle - start) * 1000.0 / frequency);
+            transformBenchmark.kernelMs = std::min(transformBenchmark.kernelMs, (end - middle) * 1000.0 / frequency);
+        }
+
+        // Largest difference relative to the magnitude of the element
+        for(size_t i = 0; i < count; ++i)
+        {
+            for(int col = 0; col < 4; ++col)
+            {
+                for(int row = 0; row < 4; ++row)
+                {
+                    float expected = reference[i][col][row];
+                    float error = std::fabs(kernel[i][col][row] - expected) / std::max(1.0f, std::fabs(expected));
+                    transformBenchmark.maxError = std::max(transformBenchmark.maxError, error);
+                }
+            }
+        }
+    }
+
+    // Every configuration is drawn several times between glFinish calls, so
+    // the time covers both CPU submission and GPU execution. The frame is
+    // cleared afterwards.
+    void runDrawBenchmark()
+    {
+        static const int counts[DrawBenchmark::Steps] = { 1, 4, 16, 64, 256, 1024, 4096, 16384 };
+        static const int paths[3] = { PerDraw, Batched, Instanced };
+        const int iterations = 10;
+
+        int savedRenderPath = renderPath;
+        GLState::current().setEnabled(GL_DEPTH_TEST, false);
+        renderQueue.policy = RenderQueue::BackToFront;
+        depthLayer = 0.0f;
+
+        drawBenchmark = DrawBenchmark();
+        std::vector<glm::mat4> models;
+        double frequency = (double)SDL_GetPerformanceFrequency();
+        for(int step = 0; step < DrawBenchmark::Steps; ++step)
+        {
+            int count = counts[step];
+            drawBenchmark.counts[step] = count;
+
+            // Tiled over the window
+            int columns = (int)std::ceil(std::sqrt((float)count));
+            float cellSize = (float)std::min(displayWidth, displayHeight) / columns;
+            models.resize(count);
+            for(int i = 0; i < count; ++i)
+            {
+                glm::mat4 m = glm::translate(glm::identity<glm::mat4>(), glm::vec3((i % columns) * cellSize, (i / columns) * cellSize, 0.0f));
+                models[i] = glm::scale(m, glm::vec3(cellSize / 512.0f, cellSize / 512.0f, 1.0f));
+            }
+
+            for(int p = 0; p < 3; ++p)
+            {
+                if (paths[p] == Instanced && !colorPass.instancedProgram)
+                {
+                    continue;
+                }
+
+                renderPath = paths[p];
+                usePass(&colorPass);
+
+                glFinish();
+                Uint64 start = SDL_GetPerformanceCounter();
+                for(int iteration = 0; iteration < iterations; ++iteration)
+                {
+                    if (renderPath == Instanced)
+                    {
+                        drawInstances(models);
+                    }
+                    else
+                    {
+                        for(int i = 0; i < count; ++i)
+                        {
+                            drawMike(models[i]);
+                        }
+                    }
+                    flushDraws();
+                }
+                glFinish();
+                drawBenchmark.ms[p][step] = (SDL_GetPerformanceCounter() - start) * 1000.0 / frequency / iterations;
+            }
+
+            if (!drawBenchmark.batchedCrossover && drawBenchmark.ms[1][step] < drawBenchmark.ms[0][step])
+            {
+                drawBenchmark.batchedCrossover = count;
+            }
+            if (!drawBenchmark.instancedCrossover && colorPass.instancedProgram && drawBenchmark.ms[2][step] < drawBenchmark.ms[1][step])
+            {
+                drawBenchmark.instancedCrossover = count;
+            }
+        }
 
-            projectionMatrix[3][2] = 0.1f;
+        spriteBatch->end();
+        renderPath = savedRenderPath;
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    }
+
+    virtual void userRender() override
+    {
+        if (drawBenchmarkRequested)
+        {
+            runDrawBenchmark();
+            drawBenchmarkRequested = false;
+        }
+
+        if (textureLoader->poll() > 0)
+        {
+            textureCache->collect();
+            createSpriteArray();
+            createSpriteAtlas();
+            if (mikeSpriteTex && backgroundTex->state != Texture::Pending && mikeSpriteTex->state != Texture::Pending)
+            {
+                releaseSpriteImages();
+            }
+        }
+
+        if (displayWidth != projectionWidth || displayHeight != projectionHeight)
+        {
+            projectionDirty = true;
+        }
+
+        if (projectionDirty)
+        {
+            updateProjection();
+        }
+
+        if (modelDirty)
+        {
+            scene.setTRSC(mikeNode, mikePosition, mikeRotation, mikeScale, mikeCenterPoint);
+            modelDirty = false;
+        }
+
+        updateStressTest();
+
+        if (animate)
+        {
+            float angle = SDL_GetTicks() * 0.09f; // 90 degrees per second
+            for(size_t i = 0; i < mikeCount(); ++i)
+            {
+                int node = mikeNodeAt(i);
+                float baseRoll = copyCount ? 0.0f : mikeRotation.z;
+                scene.rotationZ[node] = std::fmod(baseRoll + angle + i * 7.0f, 360.0f);
+                scene.markDirty(node);
+            }
+        }
+
+        Uint64 transformStart = SDL_GetPerformanceCounter();
+        size_t updated = scene.update();
+        transformMs = (SDL_GetPerformanceCounter() - transformStart) * 1000.0f / SDL_GetPerformanceFrequency();
+        RenderStats::frame().matricesUpdated += (int)updated;
+        modelMatrix = scene.world(mikeNode);
+
+        cullObjects(updated > 0);
+
+        if (GpuTimer::supported())
+        {
+            if (sceneTimer.poll())
+            {
+                float &average = depthModeTimes[sceneTimer.tag];
+                average = average == 0.0f ? sceneTimer.milliseconds : average * 0.95f + sceneTimer.milliseconds * 0.05f;
+            }
+            sceneTimer.begin(depthMode);
+        }
+
+        // Per draw commands are ordered by the render queue policy. The
+        // batched and instanced paths draw in submission order.
+        if (depthMode == BackToFront) {
+            GLState::current().setEnabled(GL_DEPTH_TEST, false);
+            renderQueue.policy = RenderQueue::BackToFront;
+            usePass(&colorPass);
+
+            depthLayer = 0.0f;
             drawBackground();
+            drawMike();
+        } else if (depthMode == FrontToBack) {
+            GLState::current().setEnabled(GL_DEPTH_TEST, true);
+            renderQueue.policy = RenderQueue::FrontToBack;
+            usePass(&colorPass);
+
+            depthLayer = 0.0f;
+            drawMike();
+
+            depthLayer = 0.1f;
+            drawBackgroundTested();
         } else {
-            glDisable(GL_DEPTH_TEST);
+            GLState::current().setEnabled(GL_DEPTH_TEST, true);
+            renderQueue.policy = RenderQueue::FrontToBack;
+
+            // Fill the depth buffer with the trivial program first
+            usePass(&depthPass);
+            glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+            depthLayer = 0.0f;
+            drawMike();
+            depthLayer = 0.1f;
             drawBackground();
+            flushDraws();
+            glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+            // Then only the fragments that won the depth test get shaded
+            usePass(&colorPass);
+            glDepthFunc(GL_EQUAL);
+            glDepthMask(GL_FALSE);
+            depthLayer = 0.0f;
             drawMike();
+            depthLayer = 0.1f;
+            drawBackground();
+            flushDraws();
+            glDepthFunc(GL_LESS);
+            glDepthMask(GL_TRUE);
         }
+
+        spriteBatch->end();
+        indirectBatch->end();
+        renderQueue.execute();
+
+        sceneTimer.end();
     }
 
     virtual void userRenderUI() override
@@ -222,11 +1226,114 @@ struct DemoApp : public BaseApp
         ImGui::End();
 
         ImGui::Begin("Control Panel");
-        ImGui::Checkbox("Use Orthographic Projection", &useOrtho);
-        ImGui::Checkbox("Front to Back", &useFrontToBack);
-        ImGui::SliderFloat("Field of View", &fieldOfView, 0, 180);
-        ImGui::SliderFloat("Vanish Point X", &vanishPoint.x, 0, displayWidth);
-        ImGui::SliderFloat("Vanish Point Y", &vanishPoint.y, 0, displayHeight);
+        ImGui::Checkbox("On-demand Rendering", &onDemand);
+        projectionDirty |= ImGui::Checkbox("Use Orthographic Projection", &useOrtho);
+        const char *depthModes[] = { "Back to Front", "Front to Back", "Depth Pre-pass" };
+        projectionDirty |= ImGui::Combo("Depth Mode", &depthMode, depthModes, IM_ARRAYSIZE(depthModes));
+        const char *renderPaths[] = { "Per Draw", "Sprite Batch (CPU transform)", "Instanced", "Multi-Draw Indirect" };
+        ImGui::Combo("Render Path", &renderPath, renderPaths, IM_ARRAYSIZE(renderPaths));
+        if (ImGui::TreeNode("GPU Time per Depth Mode"))
+        {
+            if (GpuTimer::supported())
+            {
+                for(int mode = 0; mode < IM_ARRAYSIZE(depthModes); ++mode)
+                {
+                    ImGui::Text("%s: %.3f ms", depthModes[mode], depthModeTimes[mode]);
+                }
+            }
+            else
+            {
+                ImGui::TextDisabled("Timer queries unavailable");
+            }
+            ImGui::TreePop();
+        }
+        if (renderPath == Instanced && !instancedProgram)
+        {
+            ImGui::TextDisabled("Instancing unavailable, drawing per object");
+        }
+        if (renderPath == Indirect && !indirectBatch->usesIndirect())
+        {
+            ImGui::TextDisabled("Indirect draws unavailable, using glMultiDrawArrays");
+        }
+        if (renderPath == Batched || renderPath == Indirect)
+        {
+            const char *spriteTextureModes[] = { "Separate", "Texture Array", "Atlas" };
+            ImGui::Combo("Sprite Textures", &spriteTextures, spriteTextureModes, IM_ARRAYSIZE(spriteTextureModes));
+            if (spriteTextures == ArrayTextures && !batchesTextureArray())
+            {
+                ImGui::TextDisabled(renderPath == Batched ? "Texture arrays unavailable, one batch per texture" : "Texture arrays only apply to the sprite batch");
+            }
+            if (spriteTextures == AtlasTextures && spriteAtlas)
+            {
+                ImGui::Text("Atlas: %d page(s) of %dx%d, %.0f%% used, %.1f KB", (int)spriteAtlas->pages.size(),
+                            spriteAtlas->pageWidth, spriteAtlas->pageHeight, spriteAtlas->efficiency() * 100.0f, spriteAtlas->byteCount() / 1024.0f);
+            }
+        }
+        const char *stressLevels[] = { "Off", "1k mikes", "10k mikes", "100k mikes" };
+        ImGui::Combo("Stress Test", &stressLevel, stressLevels, IM_ARRAYSIZE(stressLevels));
+        cullingDirty |= ImGui::Checkbox("Frustum Culling", &useCulling);
+        ImGui::Checkbox("Animate", &animate);
+        if (TransformKernel::vectorized())
+        {
+            ImGui::Checkbox("Vectorized Transforms", &scene.useKernel);
+        }
+        if (ImGui::TreeNode("Texture Sampling"))
+        {
+            const char *mikeSources[] = { "PNG (RGBA8)", "KTX 2, best supported format", "KTX 2, CPU decompressed" };
+            if (ImGui::Combo("Mike Texture", &mikeSource, mikeSources, IM_ARRAYSIZE(mikeSources)))
+            {
+                loadMikeTexture();
+            }
+            ImGui::Checkbox("Premultiply Alpha on Load", &textureLoader->premultiplyAlpha);
+
+            bool samplingChanged = false;
+            const char *filters[] = { "Linear (no mipmaps)", "Bilinear", "Trilinear" };
+            samplingChanged |= ImGui::Combo("Min Filter", &textureFilter, filters, IM_ARRAYSIZE(filters));
+            if (Texture::maxAnisotropy() > 1.0f)
+            {
+                samplingChanged |= ImGui::SliderFloat("Anisotropy", &textureAnisotropy, 1.0f, Texture::maxAnisotropy(), "%.0fx");
+            }
+            else
+            {
+                ImGui::TextDisabled("Anisotropic filtering unavailable");
+            }
+            if (samplingChanged)
+            {
+                backgroundTex->setSampling((Texture::Filter)textureFilter, textureAnisotropy);
+                mikeTex->setSampling((Texture::Filter)textureFilter, textureAnisotropy);
+            }
+
+            size_t totalBytes = 0;
+            Texture *textures[] = { backgroundTex, mikeTex };
+            for(int t = 0; t < IM_ARRAYSIZE(textures); ++t)
+            {
+                Texture *texture = textures[t];
+                ImGui::Text("%s: %dx%d %s, %d levels, %.1f KB (base %.1f KB)", texture->filePath.c_str(), texture->width, texture->height,
+                            texture->formatName(), texture->levelCount(), texture->byteCount() / 1024.0f, texture->levelByteCount(0) / 1024.0f);
+                totalBytes += texture->byteCount();
+            }
+            ImGui::Text("Texture memory: %.1f KB", totalBytes / 1024.0f);
+            ImGui::Text("Texture cache: %d resident, %.1f KB, %d path hits, %d content hits, %d misses", (int)textureCache->size(),
+                        textureCache->byteCount() / 1024.0f, textureCache->pathHits, textureCache->contentHits, textureCache->misses);
+
+            float level = mikeSampledLevel();
+            if (level >= 0.0f)
+            {
+                // Texels fetched per frame follow the sampled level, the
+                // base level when there is no mip chain to pick from
+                int sampled = mikeTex->hasMipmaps ? std::min((int)level, mikeTex->levelCount() - 1) : 0;
+                size_t readBytes = mikeTex->levelByteCount(sampled);
+                if (mikeTex->hasMipmaps && textureFilter == Texture::Trilinear && sampled + 1 < mikeTex->levelCount())
+                {
+                    readBytes += mikeTex->levelByteCount(sampled + 1);
+                }
+                ImGui::Text("Mike samples level %.1f, reading ~%.1f KB per frame", level, readBytes / 1024.0f);
+            }
+            ImGui::TreePop();
+        }
+        projectionDirty |= ImGui::SliderFloat("Field of View", &fieldOfView, 0, 180);
+        projectionDirty |= ImGui::SliderFloat("Vanish Point X", &vanishPoint.x, 0, displayWidth);
+        projectionDirty |= ImGui::SliderFloat("Vanish Point Y", &vanishPoint.y, 0, displayHeight);
 
         if (ImGui::TreeNode("Projection Matrix Viewer"))
         {
@@ -265,17 +1372,90 @@ struct DemoApp : public BaseApp
             ImGui::TreePop();
         }
 
-        ImGui::SliderFloat("Translate X", &mikePosition.x, -displayWidth, displayWidth);
-        ImGui::SliderFloat("Translate Y", &mikePosition.y, -displayWidth, displayWidth);
-        ImGui::SliderFloat("Translate Z", &mikePosition.z, -8000.0f, 8000.0f);
-        ImGui::SliderFloat("Rotate X", &mikeRotation.x, 0, 360);
-        ImGui::SliderFloat("Rotate Y", &mikeRotation.y, 0, 360);
-        ImGui::SliderFloat("Rotate Z", &mikeRotation.z, 0, 360);
-        ImGui::SliderFloat("Scale X", &mikeScale.x, -2, 4);
-        ImGui::SliderFloat("Scale Y", &mikeScale.y, -2, 4);
-        ImGui::SliderFloat("Center X", &mikeCenterPoint.x, 0, 512);
-        ImGui::SliderFloat("Center Y", &mikeCenterPoint.y, 0, 512);
-        ImGui::SliderFloat("Center Z", &mikeCenterPoint.z, 0, 512);
+        modelDirty |= ImGui::SliderFloat("Translate X", &mikePosition.x, -displayWidth, displayWidth);
+        modelDirty |= ImGui::SliderFloat("Translate Y", &mikePosition.y, -displayWidth, displayWidth);
+        modelDirty |= ImGui::SliderFloat("Translate Z", &mikePosition.z, -8000.0f, 8000.0f);
+        modelDirty |= ImGui::SliderFloat("Rotate X", &mikeRotation.x, 0, 360);
+        modelDirty |= ImGui::SliderFloat("Rotate Y", &mikeRotation.y, 0, 360);
+        modelDirty |= ImGui::SliderFloat("Rotate Z", &mikeRotation.z, 0, 360);
+        modelDirty |= ImGui::SliderFloat("Scale X", &mikeScale.x, -2, 4);
+        modelDirty |= ImGui::SliderFloat("Scale Y", &mikeScale.y, -2, 4);
+        modelDirty |= ImGui::SliderFloat("Center X", &mikeCenterPoint.x, 0, 512);
+        modelDirty |= ImGui::SliderFloat("Center Y", &mikeCenterPoint.y, 0, 512);
+        modelDirty |= ImGui::SliderFloat("Center Z", &mikeCenterPoint.z, 0, 512);
+
+        ImGui::Text("Draw calls: %d (%d sprites batched in %d flushes)", RenderStats::frame().drawCalls, RenderStats::frame().spritesDrawn, RenderStats::frame().batchFlushes);
+        ImGui::Text("Matrices recomputed: %d in %.3f ms", RenderStats::frame().matricesUpdated, transformMs);
+        ImGui::Text("Objects visible: %d (%d culled)", RenderStats::frame().objectsVisible, RenderStats::frame().objectsCulled);
+        ImGui::Text("Occlusion queries: %d (%d hidden draws skipped)", RenderStats::frame().occlusionQueries, RenderStats::frame().occlusionSkipped);
+        ImGui::Text("Instances drawn: %d", RenderStats::frame().instancesDrawn);
+        ImGui::Text("Multi-draw objects: %d", RenderStats::frame().indirectDraws);
+        ImGui::Text("Stream buffer stalls: %d", RenderStats::frame().streamStalls);
+        ImGui::Text("Redundant state changes filtered: %d", RenderStats::frame().redundantStateCalls);
+        ImGui::Text("Uniform uploads: %d (%d unchanged values skipped)", RenderStats::frame().uniformUploads, RenderStats::frame().uniformUploadsSkipped);
+        ImGui::Text("Attribute setup calls: %d (%d saved by VAO cache)", RenderStats::frame().attributeCalls, RenderStats::frame().attributeCallsSaved);
+        if (textureLoader->busy())
+        {
+            ImGui::Text("Textures loading: %d", textureLoader->pendingCount);
+        }
+        if (ImGui::TreeNode("Benchmarks"))
+        {
+            if (ImGui::Button("Run Transform Benchmark"))
+            {
+                runTransformBenchmark();
+            }
+            if (transformBenchmark.count)
+            {
+                ImGui::Text("%d TRSC matrices: glm %.3f ms, kernel %.3f ms (%.1fx)", (int)transformBenchmark.count,
+                            transformBenchmark.referenceMs, transformBenchmark.kernelMs, transformBenchmark.referenceMs / transformBenchmark.kernelMs);
+                ImGui::Text("Largest relative difference: %g", transformBenchmark.maxError);
+            }
+            if (ImGui::Button("Run Draw Benchmark"))
+            {
+                drawBenchmarkRequested = true;
+                requestRedraw();
+            }
+            if (drawBenchmark.counts[0] && ImGui::BeginTable("DrawBenchmark", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg))
+            {
+                ImGui::TableSetupColumn("Mikes");
+                ImGui::TableSetupColumn("Per Draw ms");
+                ImGui::TableSetupColumn("Sprite Batch ms");
+                ImGui::TableSetupColumn("Instanced ms");
+                ImGui::TableHeadersRow();
+                for(int step = 0; step < DrawBenchmark::Steps; ++step)
+                {
+                    ImGui::TableNextRow();
+                    ImGui::TableSetColumnIndex(0);
+                    ImGui::Text("%d", drawBenchmark.counts[step]);
+                    for(int p = 0; p < 3; ++p)
+                    {
+                        ImGui::TableSetColumnIndex(p + 1);
+                        ImGui::Text("%.3f", drawBenchmark.ms[p][step]);
+                    }
+                }
+                ImGui::EndTable();
+            }
+            if (drawBenchmark.counts[0])
+            {
+                if (drawBenchmark.batchedCrossover)
+                {
+                    ImGui::Text("Sprite Batch beats Per Draw from %d mikes", drawBenchmark.batchedCrossover);
+                }
+                else
+                {
+                    ImGui::Text("Sprite Batch never beats Per Draw");
+                }
+                if (drawBenchmark.instancedCrossover)
+                {
+                    ImGui::Text("Instanced beats Sprite Batch from %d mikes", drawBenchmark.instancedCrossover);
+                }
+                else
+                {
+                    ImGui::Text("Instanced never beats Sprite Batch");
+                }
+            }
+            ImGui::TreePop();
+        }
 
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();